@@ -0,0 +1,240 @@
+/**
+ * @filename   fifobench.c
+ *   Benchmark throughput (MB/s) of large msgs: chunked by library vs
+ *   split into 4 KB msgs by application.
+ *
+ *   $ ./fifobench -s 256 -n 200 -e
+ *   $ ./fifobench -s 256 -n 200 -e -m 1024     (shared memory rings)
+ *   $ ./fifobench -s 256 -n 200 -e -z          (zero-copy handler)
+ */
+#include "../src/fifo.h"
+
+#include "../src/unitypes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <pthread.h>
+#include <getopt.h>
+
+
+#define  APPNAME     "fifobench"
+#define  APPVER      "0.0.1"
+
+#define  BENCH_PIPENAME   "/tmp/namedpipe-fifobench"
+
+// 1: server echoes request; 0: server replies a short ack
+static int echo = 0;
+
+// 1: server handles msgs fit in one frame by view callback
+static int zerocopy = 0;
+
+
+static void onpipemsg (const fifo_pipemsg_t *request, fifo_pipemsg_t *reply, void *argument)
+{
+    if (echo) {
+        reply->msgsz = request->msgsz;
+        memcpy(reply->msgbuf, request->msgbuf, request->msgsz);
+    } else {
+        reply->msgsz = 2;
+        memcpy(reply->msgbuf, "ok", 2);
+    }
+}
+
+
+static void onmsgbuf (const fifo_msgbuf_t *request, fifo_msgbuf_t *reply, void *argument)
+{
+    if (echo) {
+        if (fifo_msgbuf_reserve(reply, request->msgsz) == FIFO_S_OK) {
+            memcpy(reply->msgbuf, request->msgbuf, request->msgsz);
+            reply->msgsz = request->msgsz;
+        }
+    } else if (fifo_msgbuf_reserve(reply, 2) == FIFO_S_OK) {
+        memcpy(reply->msgbuf, "ok", 2);
+        reply->msgsz = 2;
+    }
+}
+
+
+static void onmsgview (const char *msg, int msgsz, fifo_reply_t *reply, void *argument)
+{
+    if (echo) {
+        struct iovec iov;
+
+        iov.iov_base = (void *) msg;
+        iov.iov_len = msgsz;
+
+        fifo_reply_iov(reply, &iov, 1);
+    } else {
+        char *ack = fifo_reply_buffer(reply, 2);
+
+        if (ack) {
+            memcpy(ack, "ok", 2);
+            fifo_reply_commit(reply, 2);
+        }
+    }
+}
+
+
+static void * server_thread (void *arg)
+{
+    fifo_server server = (fifo_server) arg;
+    fifo_handler_t handler = {0};
+
+    handler.msgbufcb = onmsgbuf;
+
+    if (zerocopy) {
+        handler.viewcb = onmsgview;
+    } else {
+        handler.pipemsgcb = onpipemsg;
+    }
+
+    fifo_server_runforever_ex(server, &handler, 0, 0);
+    return 0;
+}
+
+
+static double elapsed_sec (const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+
+// application splits payload into 4 KB msgs, one round trip each
+static int bench_pipemsg (fifo_client client, const char *payload, size_t size, int count)
+{
+    int i;
+    size_t offset, cb;
+    fifo_pipemsg_t msg;
+
+    for (i = 0; i < count; i++) {
+        for (offset = 0; offset < size; offset += cb) {
+            cb = size - offset;
+            if (cb > sizeof(msg.msgbuf)) {
+                cb = sizeof(msg.msgbuf);
+            }
+
+            msg.msgsz = (int32_t) cb;
+            memcpy(msg.msgbuf, payload + offset, cb);
+
+            if (fifo_client_write(client, &msg) != FIFO_S_OK || fifo_client_read(client, &msg) != FIFO_S_OK) {
+                return FIFO_E_FAILED;
+            }
+        }
+    }
+
+    return FIFO_S_OK;
+}
+
+
+// library chunks payload, one round trip per payload
+static int bench_msgbuf (fifo_client client, const char *payload, size_t size, int count)
+{
+    int i, rc = FIFO_S_OK;
+    fifo_msgbuf_t reply = {0};
+
+    for (i = 0; i < count && rc == FIFO_S_OK; i++) {
+        rc = fifo_client_sendmsg(client, payload, size);
+        if (rc == FIFO_S_OK) {
+            rc = fifo_client_recvmsg(client, &reply);
+        }
+
+        if (rc == FIFO_S_OK && echo && (reply.msgsz != size || memcmp(reply.msgbuf, payload, size))) {
+            printf("bad echo reply.\n");
+            rc = FIFO_E_FAILED;
+        }
+    }
+
+    fifo_msgbuf_free(&reply);
+    return rc;
+}
+
+
+int main (int argc, char *argv[])
+{
+    int ch, count = 200;
+    size_t i, size = 256 * 1024;
+    double sec;
+    char *payload;
+
+    struct timespec t0;
+    pthread_t thread;
+
+    fifo_server server;
+    fifo_client client;
+    fifo_client_opts_t opts = {0};
+
+    while ((ch = getopt(argc, argv, "s:n:m:ezh")) != -1) {
+        switch (ch) {
+        case 's':
+            size = (size_t) atoi(optarg) * 1024;
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'm':
+            opts.shmsize = atoi(optarg) * 1024;
+            break;
+        case 'e':
+            echo = 1;
+            break;
+        case 'z':
+            zerocopy = 1;
+            break;
+        default:
+            printf("usage: %s [-s KB] [-n count] [-m ring KB] [-e] [-z]\n", APPNAME);
+            exit(0);
+        }
+    }
+
+    if (size == 0 || size > FIFO_MSGBUF_MAX || count <= 0) {
+        printf("bad size or count.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    payload = (char *) malloc(size);
+    for (i = 0; i < size; i++) {
+        payload[i] = (char) ('a' + i % 26);
+    }
+
+    if (fifo_server_new(BENCH_PIPENAME, FIFO_TIMEOUT, FIFO_CONNECT_TIMEOUT, &server) != FIFO_S_OK) {
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_create(&thread, NULL, server_thread, (void *) server);
+
+    if (fifo_client_new_ex(BENCH_PIPENAME, 3000, &opts, &client) != FIFO_S_OK) {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%s-%s: %d msgs of %" PRIu64 " bytes, %s, %s\n", APPNAME, APPVER, count, (uint64_t) size, echo? "echo" : "ack", opts.shmsize? "shm" : "pipe");
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (bench_pipemsg(client, payload, size, count) != FIFO_S_OK) {
+        printf("4 KB msgs failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    sec = elapsed_sec(&t0);
+    printf("4 KB msgs:    %8.3f sec  %10.2f MB/s\n", sec, (double) size * count / sec / 1048576);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (bench_msgbuf(client, payload, size, count) != FIFO_S_OK) {
+        printf("chunked msgs failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    sec = elapsed_sec(&t0);
+    printf("chunked msgs: %8.3f sec  %10.2f MB/s\n", sec, (double) size * count / sec / 1048576);
+
+    fifo_client_free(client);
+    free(payload);
+
+    fifo_print_pools();
+
+    return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * @filename   fifop99.c
+ *   Benchmark latency percentiles under skewed client load: a few hot
+ *   clients keep many pipelined calls in flight while cold clients make
+ *   one call at a time. Thread-per-client serves all calls of a hot
+ *   client by one thread; work-stealing workers spread them.
+ *
+ *   $ ./fifop99 -t                 (thread-per-client)
+ *   $ ./fifop99 -w 4               (reactor + 4 workers, one queue)
+ *   $ ./fifop99 -w 4 -s            (reactor + 4 work-stealing workers)
+ *   $ ./fifop99 -w 4 -s -H 4 -C 16 -d 64 -c 50 -n 4000
+ */
+#include "../src/fifo.h"
+
+#include "../src/unitypes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <pthread.h>
+#include <getopt.h>
+
+
+#define  APPNAME     "fifop99"
+#define  APPVER      "0.0.1"
+
+#define  P99_PIPENAME     "/tmp/namedpipe-fifop99"
+
+// us of cpu burnt by handler per request
+static int cost = 20;
+
+
+typedef struct
+{
+    pthread_t thread;
+
+    // calls in flight
+    int depth;
+    int count;
+
+    int done;
+    int failed;
+    int64_t *latency;
+} p99_client_t;
+
+
+static int64_t now_usec (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+static void onpipemsg (const fifo_pipemsg_t *request, fifo_pipemsg_t *reply, void *argument)
+{
+    int64_t until = now_usec() + cost;
+
+    while (now_usec() < until) {
+        // busy handler
+    }
+
+    // echo send time
+    reply->msgsz = request->msgsz;
+    memcpy(reply->msgbuf, request->msgbuf, request->msgsz);
+}
+
+
+static void * server_thread (void *arg)
+{
+    fifo_server server = (fifo_server) arg;
+    fifo_handler_t handler = {0};
+
+    handler.pipemsgcb = onpipemsg;
+
+    fifo_server_runforever_ex(server, &handler, 0, 0);
+    return 0;
+}
+
+
+static void onreply (fifo_client client, int status, const fifo_pipemsg_t *reply, void *argument)
+{
+    int64_t sent;
+    p99_client_t *pc = (p99_client_t *) argument;
+
+    if (status != FIFO_S_OK || reply->msgsz != sizeof(sent)) {
+        pc->failed++;
+        return;
+    }
+
+    memcpy(&sent, reply->msgbuf, sizeof(sent));
+
+    pc->latency[pc->done++] = now_usec() - sent;
+}
+
+
+static void * client_thread (void *arg)
+{
+    int sent = 0;
+    fifo_client client;
+    fifo_pipemsg_t msg;
+    p99_client_t *pc = (p99_client_t *) arg;
+
+    if (fifo_client_new(P99_PIPENAME, 10000, &client) != FIFO_S_OK) {
+        pc->failed = pc->count;
+        return 0;
+    }
+
+    while (pc->done + pc->failed < pc->count) {
+        while (sent < pc->count && fifo_client_pending(client) < pc->depth) {
+            int64_t now = now_usec();
+
+            msg.msgsz = (int32_t) sizeof(now);
+            memcpy(msg.msgbuf, &now, sizeof(now));
+
+            if (fifo_client_call_async(client, &msg, onreply, pc) != FIFO_S_OK) {
+                pc->failed++;
+            }
+            sent++;
+        }
+
+        if (fifo_client_poll(&client, 1, 1000) < 0) {
+            pc->failed = pc->count - pc->done;
+        }
+    }
+
+    fifo_client_free(client);
+    return 0;
+}
+
+
+static int cmp_int64 (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+// print percentiles of latencies of clients[from, to)
+static void print_latency (const char *name, p99_client_t *clients, int from, int to)
+{
+    int i, n = 0;
+    int64_t *all;
+
+    for (i = from; i < to; i++) {
+        n += clients[i].done;
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    all = (int64_t *) malloc(sizeof(int64_t) * n);
+
+    for (n = 0, i = from; i < to; i++) {
+        memcpy(all + n, clients[i].latency, sizeof(int64_t) * clients[i].done);
+        n += clients[i].done;
+    }
+
+    qsort(all, n, sizeof(int64_t), cmp_int64);
+
+    printf("%-5s calls=%-8d p50=%-8" PRId64 " p90=%-8" PRId64 " p99=%-8" PRId64 " max=%" PRId64 " (us)\n",
+        name, n, all[n / 2], all[n * 9 / 10], all[n * 99 / 100], all[n - 1]);
+
+    free(all);
+}
+
+
+int main (int argc, char *argv[])
+{
+    int ch, i, failed = 0;
+    int hot = 2, cold = 8, depth = 32, count = 2000;
+    int64_t t0;
+
+    pthread_t thread;
+    fifo_server server;
+    fifo_server_opts_t opts = {0};
+
+    p99_client_t *clients;
+
+    opts.mode = FIFO_SERVER_MODE_REACTOR;
+    opts.workers = -1;
+
+    while ((ch = getopt(argc, argv, "tw:spH:C:d:c:n:h")) != -1) {
+        switch (ch) {
+        case 't':
+            opts.mode = FIFO_SERVER_MODE_THREADS;
+            break;
+        case 'w':
+            opts.workers = atoi(optarg);
+            break;
+        case 's':
+            opts.steal = 1;
+            break;
+        case 'p':
+            opts.pipeline = 1;
+            break;
+        case 'H':
+            hot = atoi(optarg);
+            break;
+        case 'C':
+            cold = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'c':
+            cost = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            printf("usage: %s [-t | -w workers [-s] [-p]] [-H hot] [-C cold] [-d depth] [-c cost us] [-n calls]\n", APPNAME);
+            exit(0);
+        }
+    }
+
+    if (hot < 0 || cold < 0 || hot + cold == 0 || depth <= 0 || cost < 0 || count <= 0) {
+        printf("bad options.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fifo_server_new_ex(P99_PIPENAME, FIFO_TIMEOUT, FIFO_CONNECT_TIMEOUT, &opts, &server) != FIFO_S_OK) {
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_create(&thread, NULL, server_thread, (void *) server);
+
+    printf("%s-%s: %s, %d hot clients (depth %d), %d cold, %d calls each, %d us per call\n", APPNAME, APPVER,
+        opts.mode == FIFO_SERVER_MODE_THREADS? "thread-per-client" : (opts.steal? "work-stealing workers" : "workers"),
+        hot, depth, cold, count, cost);
+
+    clients = (p99_client_t *) calloc(hot + cold, sizeof(p99_client_t));
+
+    t0 = now_usec();
+
+    for (i = 0; i < hot + cold; i++) {
+        clients[i].depth = (i < hot? depth : 1);
+        clients[i].count = count;
+        clients[i].latency = (int64_t *) malloc(sizeof(int64_t) * count);
+
+        pthread_create(&clients[i].thread, NULL, client_thread, (void *) &clients[i]);
+    }
+
+    for (i = 0; i < hot + cold; i++) {
+        pthread_join(clients[i].thread, NULL);
+        failed += clients[i].failed;
+    }
+
+    printf("elapsed %.3f sec, failed %d\n", (now_usec() - t0) / 1e6, failed);
+
+    print_latency("hot", clients, 0, hot);
+    print_latency("cold", clients, hot, hot + cold);
+    print_latency("all", clients, 0, hot + cold);
+
+    for (i = 0; i < hot + cold; i++) {
+        free(clients[i].latency);
+    }
+    free(clients);
+
+    return 0;
+}
@@ -213,6 +213,13 @@ typedef struct _fifo_client_t
 
 
 int fifo_server_new (const char *pathname, int client_timeout, int connect_timeout, fifo_server *server)
+{
+    return fifo_server_new_ex(pathname, client_timeout, connect_timeout, NULL, server);
+}
+
+
+// opts are ignored: Windows server is always driven by overlapped completion routines
+int fifo_server_new_ex (const char *pathname, int client_timeout, int connect_timeout, const fifo_server_opts_t *opts, fifo_server *server)
 {
     fifo_server_t *srvr;
     size_t namelen;
@@ -467,6 +474,22 @@ int fifo_client_write (fifo_client client, const fifo_pipemsg_t *msg)
 }
 
 
+// message mode pipe keeps msg boundaries: one WriteFile per msg
+int fifo_client_write_batch (fifo_client client, const fifo_pipemsg_t *msgs[], int nmsgs)
+{
+    int i, rc;
+
+    for (i = 0; i < nmsgs; i++) {
+        rc = fifo_client_write(client, msgs[i]);
+        if (rc != FIFO_S_OK) {
+            return rc;
+        }
+    }
+
+    return FIFO_S_OK;
+}
+
+
 // Read from the pipe. set nNumberOfBytesToRead with bufsize
 int fifo_client_read (fifo_client client, fifo_pipemsg_t *msg)
 {
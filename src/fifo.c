@@ -41,522 +41,6569 @@
 #include "unitypes.h"
 
 #include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+    # include <sys/prctl.h>
+#endif
+
+#if defined(__linux__) && !defined(FIFO_NO_EPOLL)
+    # define FIFO_HAVE_EPOLL
+    # include <sys/epoll.h>
+    # include <sys/eventfd.h>
+    # include <sys/timerfd.h>
+#endif
+
+// build with -DFIFO_USE_IO_URING to batch reactor i/o on io_uring
+#if defined(FIFO_HAVE_EPOLL) && defined(FIFO_USE_IO_URING)
+    # include "iouring.h"
+#else
+    # undef FIFO_USE_IO_URING
+#endif
 
 
 #define FIFO_NAMELEN_MAX    255
 #define FIFO_FILE_MODE      (S_IWUSR|S_IRUSR|S_IRGRP|S_IROTH)
 
-typedef struct _fifo_server_t
-{
-    // O_NONBLOCK|O_RDWR
-    int accept_pipefd;
+// supervisor of worker processes checks on them at this interval
+//   if it has a loop callback to call
+#define FIFO_SUPERVISE_MSEC  100
 
-    // config settings
-    struct timeval client_timeout;
-    struct timeval connect_timeout;
+// max events returned from one epoll_wait
+#define FIFO_EPOLL_EVENTS   256
 
-    // The entire pipe name string can be up to 256 characters long.
-    // Pipe names are not case sensitive.
-    int namelen;
-    char pipename[0];
-} fifo_server_t;
+// max reads from one pipe in a batch before rearmed
+#define FIFO_URING_ROUNDS   16
 
+// reply frames of one batch are packed into a reactor buffer of this size
+#define FIFO_URING_TXBUF    (PIPEMSG_SIZE_MAX * 64)
 
-typedef struct _fifo_client_t
-{
-    int readfd;
-    int writefd;
+// a whole frame always fits after a partial one
+#define FIFO_RXBUF_SIZE     (PIPEMSG_SIZE_MAX * 2)
 
-    struct timeval wait_timeout;
+// hash buckets of outstanding async calls per client (power of 2)
+#define FIFO_CALL_BUCKETS   1024
 
-    int namelen;
-    char pipename[0];
-} fifo_client_t;
+// clients polled with pollfds on stack
+#define FIFO_POLL_CLIENTS   64
 
+// microseconds a request may wait in client to be coalesced by default
+#define FIFO_CLIENT_LINGER  200
 
-typedef struct
-{
-    int requestfd;
-    int replyfd;
+// client takes acks every so many one-way msgs sent
+#define FIFO_ACK_TAKE       64
 
-    struct timeval timeout;
+// bytes of an ack frame
+#define FIFO_ACK_SIZE       12
 
-    fifo_pipemsg_t request;
-    fifo_pipemsg_t reply;
+// max frames in one writev of fifo_client_write_batch
+#define FIFO_BATCH_IOV      256
 
-    fifo_onpipemsg_cb pipemsgcb;
-    void *argument;
-} pipe_instance_t;
+// max chunks of a large msg gathered in one writev
+#define FIFO_CHUNK_IOV      32
 
+// buffer of large msg larger than this is released after use, others
+//   when pipe goes idle
+#define FIFO_MSGBUF_KEEP    (PIPEMSG_SIZE_MAX * 16)
 
-static pipe_instance_t * pipe_instance_new (int requestfd, int replyfd, fifo_onpipemsg_cb onmsgcb, void *cbarg, fifo_server server)
-{
-    pipe_instance_t *pipeinst = mem_alloc_zero(1, sizeof(*pipeinst));
+// bytes of a block of request arena
+#define FIFO_ARENA_BLOCK    (16 * 1024)
 
-    pipeinst->requestfd = requestfd;
-    pipeinst->replyfd = replyfd;
+// requests passed to batch handler in one call by default
+#define FIFO_BATCH_DEFAULT  64
 
-    pipeinst->pipemsgcb = onmsgcb;
-    pipeinst->argument = cbarg;
 
-    pipeinst->timeout.tv_sec = server->client_timeout.tv_sec;
-    pipeinst->timeout.tv_usec = server->client_timeout.tv_usec;
+// "FIFS": header of shared memory rings
+#define FIFO_SHM_MAGIC      0x53464946
 
-    return pipeinst;
-}
+// yields of a producer waiting for room in ring before it sleeps
+#define FIFO_SHM_SPINS      64
 
+// us until reactor looks again for room in ring of a client which
+//   reads no replies
+#define FIFO_SHM_RETRY_USEC 1000
 
-static void pipe_instance_free (pipe_instance_t *pipeinst)
+
+// all of frame flags known
+#define FIFO_FRAME_F_ALL    (FIFO_FRAME_F_REQID|FIFO_FRAME_F_MORE|FIFO_FRAME_F_DOORBELL|FIFO_FRAME_F_ONEWAY|FIFO_FRAME_F_ACK)
+
+
+/**
+ * fifo_frame_t
+ *   frame header fields other than msg size.
+ */
+typedef struct
 {
-    close(pipeinst->requestfd);
-    close(pipeinst->replyfd);
-    mem_free(pipeinst);
-}
+    uint32_t flags;
+    uint32_t reqid;
+} fifo_frame_t;
 
 
-static int readpipemsg_nb (int fd, fifo_pipemsg_t *msg)
+static int frame_header (char *hdr, uint32_t flags, uint32_t reqid, int msgsz)
 {
-    ssize_t count, msgsize, offset = 0;
+    int32_t head = (int32_t) (flags | (uint32_t) msgsz);
 
-    while (offset == 0) {
-        offset = read(fd, (char *)msg, sizeof(msg->msgsz));
+    memcpy(hdr, &head, sizeof(head));
 
-        if (offset == sizeof(msg->msgsz)) {
-            break;
-        }
+    if (flags & FIFO_FRAME_F_REQID) {
+        memcpy(hdr + sizeof(head), &reqid, sizeof(reqid));
+        return (int) (sizeof(head) + sizeof(reqid));
+    }
 
-        if (offset == -1 && errno == EAGAIN) {
-            continue;
-        }
+    return (int) sizeof(head);
+}
 
-        // error: read end of fd
-        return (-1);
+
+/**
+ * frame_pack_header()
+ *   build header of frame for msg into hdr (8 bytes at least) and clip
+ *   msg to max body size of frame.
+ *
+ * returns:
+ *   size of header in bytes.
+ */
+static int frame_pack_header (char *hdr, fifo_pipemsg_t *msg, const fifo_frame_t *frame)
+{
+    int hdrsz = (int) sizeof(int32_t);
+
+    if (frame->flags & FIFO_FRAME_F_REQID) {
+        hdrsz += (int) sizeof(frame->reqid);
     }
 
-    if (msg->msgsz == 0) {
-        // success: reach the end of pipe msg
-        return 0;
+    if (msg->msgsz > PIPEMSG_SIZE_MAX - hdrsz) {
+        msg->msgsz = PIPEMSG_SIZE_MAX - hdrsz;
+    }
+
+    return frame_header(hdr, frame->flags, frame->reqid, msg->msgsz);
+}
+
+
+// skip cb bytes written from iov
+static void iov_advance (struct iovec **iov, int *iovcnt, size_t cb)
+{
+    while (*iovcnt > 0 && cb >= (*iov)->iov_len) {
+        cb -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
     }
 
-    msgsize = offset + msg->msgsz;
+    if (*iovcnt > 0) {
+        (*iov)->iov_base = (char *) (*iov)->iov_base + cb;
+        (*iov)->iov_len -= cb;
+    }
+}
 
-    while ( offset < msgsize ) {
-        count = read(fd, (char *)msg + offset, msgsize - offset);
 
-        if (count > 0) {
-            offset += count;
+/**
+ * writev_all()
+ *   write all of iov. a write larger than PIPE_BUF may be partial (or
+ *   EAGAIN on O_NONBLOCK fd), the rest goes when the pipe has room.
+ */
+static int writev_all (int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t cb = writev(fd, iov, iovcnt);
 
-            if (offset == msgsize) {
-                // success: reach the end of pipe msg
-                return 0;
+        if (cb == -1) {
+            if (errno == EINTR) {
+                continue;
             }
 
-            // read next bytes
-            continue;
-        }
+            if (errno == EAGAIN) {
+                struct pollfd pfd;
 
-        if (count == -1 && errno == EAGAIN) {
-            printf("*");
-            continue;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            printf("write error: %s.\n", strerror(errno));
+            return (-1);
         }
 
-        // error read pipe
-        break;
+        iov_advance(&iov, &iovcnt, (size_t) cb);
     }
 
-    // unexpect read pipe error
-    return (-1);
+    return 0;
 }
 
 
-static void * client_fifo_worker (void *arg)       
+/**
+ * fifo_shmring_t
+ *   single producer single consumer byte ring in shared memory. head
+ *   and tail are free running counts of bytes consumed and produced.
+ */
+typedef struct
 {
-    int rc;
-    fd_set rfds;
+    // written by consumer only
+    uint64_t head;
+    char pad1[64 - sizeof(uint64_t)];
 
-    pipe_instance_t *pipeinst = (pipe_instance_t *) arg;
+    // written by producer only
+    uint64_t tail;
+    char pad2[64 - sizeof(uint64_t)];
 
-    printf("client_fifo_worker(accept_pipefd=%d) start...\n", pipeinst->requestfd);
+    // consumer sleeps on doorbell pipe
+    int waiting;
+    char pad3[64 - sizeof(int)];
+} fifo_shmring_t;
 
-    while(1) {
-        FD_ZERO(&rfds);
-        FD_SET(pipeinst->requestfd, &rfds);
 
-        if (pipeinst->timeout.tv_sec < 0) {
-            rc = select(pipeinst->requestfd + 1, &rfds, NULL, NULL, NULL);
-        } else {
-            rc = select(pipeinst->requestfd + 1, &rfds, NULL, NULL, &pipeinst->timeout);
-        }
+/**
+ * fifo_shmhdr_t
+ *   head of shared memory of a client, followed by data of rings[0]
+ *   (requests) and rings[1] (replies).
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t ringsz;
 
-        if (rc == 1) {
-            if (readpipemsg_nb(pipeinst->requestfd, &pipeinst->request) == 0) {
-                if (pipeinst->request.msgsz == 0) {
-                    printf("client closed.\n");
-                    break;
-                }
+    // set by server when it maps the rings
+    int attached;
+    char pad[64 - sizeof(uint32_t) * 2 - sizeof(int)];
 
-                pipeinst->reply.msgsz = 0;
+    fifo_shmring_t rings[2];
+} fifo_shmhdr_t;
 
-                pipeinst->pipemsgcb(&pipeinst->request, &pipeinst->reply, pipeinst->argument);
 
-                if (pipeinst->reply.msgsz > 0) {
-                    size_t cbwrite = sizeof(int32_t) + pipeinst->reply.msgsz;
-                    if (cbwrite > sizeof(pipeinst->reply)) {
-                        cbwrite = sizeof(pipeinst->reply);
-                        pipeinst->reply.msgsz = cbwrite - sizeof(int32_t);
-                    }
+/**
+ * fifo_shmend_t
+ *   one side of a ring. doorbellfd is the pipe to ring the consumer
+ *   (producer side) or to wait on (consumer side).
+ */
+typedef struct
+{
+    fifo_shmring_t *ring;
+    char *data;
+    uint32_t size;
 
-                    if (write(pipeinst->replyfd, &pipeinst->reply, cbwrite) != cbwrite) {
-                        printf("write error: %s.\n", strerror(errno));
-                        break;
-                    }
-                }
+    int doorbellfd;
+} fifo_shmend_t;
 
-                continue;
-            }
- 
-            // readpipemsg error
-            break;
-        } else if (rc == 0) {
-            // timeout with no ready
-            printf("*");
-        } else {
-            printf("select failed: %s.\n", strerror(errno));
-            break;
-        }
-    }
 
-    printf("client_fifo_worker(accept_pipefd=%d) exit.\n", pipeinst->requestfd);
+typedef struct
+{
+    fifo_shmhdr_t *hdr;
+    size_t mapsz;
 
-    pipe_instance_free(pipeinst);
-    return NULL;
-}
+    fifo_shmend_t rx;
+    fifo_shmend_t tx;
+} fifo_shm_t;
 
 
-int fifo_server_new (const char *pathname, int client_timeout, int connect_timeout, fifo_server *server)
+static size_t shm_mapsize (uint32_t ringsz)
 {
-    fifo_server_t *srvr;
-    size_t namelen;
-    const char *pipename;
-
-    if (! pathname) {
-        pipename = FIFO_NAME_LINUX_DEFAULT;
-    } else {
-        pipename = pathname;
-    }
+    return sizeof(fifo_shmhdr_t) + (size_t) ringsz * 2;
+}
 
-    namelen = strnlen(pipename, FIFO_NAMELEN_MAX - 20);
-    srvr = mem_alloc_zero(1, sizeof(*srvr)+ namelen + 1);
 
-    srvr->namelen = (int) namelen;
-    memcpy(srvr->pipename, pipename, srvr->namelen);
+/**
+ * shm_new()
+ *   setup ends of mapped rings: client produces requests and consumes
+ *   replies, server the other way round.
+ */
+static fifo_shm_t * shm_new (fifo_shmhdr_t *hdr, size_t mapsz, int isclient, int rxfd, int txfd)
+{
+    fifo_shm_t *shm = (fifo_shm_t *) mem_alloc_zero(1, sizeof(*shm));
 
-    if (mkfifo(srvr->pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
-        printf("mkfifo failed: %s.\n", strerror(errno));
-        mem_free(srvr);
-        return FIFO_E_FAILED;
-    }
+    char *data = (char *) hdr + sizeof(*hdr);
+    int rxring = (isclient? 1 : 0);
 
-    printf("open O_NONBLOCK|O_RDWR fifo: %s.\n", srvr->pipename);
-    srvr->accept_pipefd = open(srvr->pipename, O_NONBLOCK|O_RDWR);
-    if (srvr->accept_pipefd == -1) {
-        printf("open failed: %s.\n", strerror(errno));
-        fifo_server_free(srvr);
-        exit(EXIT_FAILURE);
-    }
+    shm->hdr = hdr;
+    shm->mapsz = mapsz;
 
-    if (client_timeout < 0) {
-        // wait infinite
-        srvr->client_timeout.tv_sec = -1;
-    } else {
-        srvr->client_timeout.tv_sec = client_timeout / 1000;
-        srvr->client_timeout.tv_usec = (client_timeout % 1000) * 1000;
-    }
+    shm->rx.ring = &hdr->rings[rxring];
+    shm->rx.data = data + (size_t) hdr->ringsz * rxring;
+    shm->rx.size = hdr->ringsz;
+    shm->rx.doorbellfd = rxfd;
 
-    if (connect_timeout < 0) {
-        // wait infinite
-        srvr->connect_timeout.tv_sec = -1;
-    } else {
-        srvr->connect_timeout.tv_sec = connect_timeout / 1000;
-        srvr->connect_timeout.tv_usec = (connect_timeout % 1000) * 1000;
-    }
+    shm->tx.ring = &hdr->rings[1 - rxring];
+    shm->tx.data = data + (size_t) hdr->ringsz * (1 - rxring);
+    shm->tx.size = hdr->ringsz;
+    shm->tx.doorbellfd = txfd;
 
-    *server = srvr;
-    return FIFO_S_OK;
+    return shm;
 }
 
 
-void fifo_server_free (fifo_server server)
+static void shm_free (fifo_shm_t *shm)
 {
-    if (server->accept_pipefd && server->accept_pipefd != -1) {
-        close(server->accept_pipefd);
+    if (shm) {
+        munmap(shm->hdr, shm->mapsz);
+        mem_free(shm);
     }
-
-    unlink(server->pipename);
-    mem_free(server);
 }
 
 
-const char * fifo_server_get_pipename (fifo_server server)
+// drop doorbells received on non-blocking fd
+static void shm_drain_doorbell (int fd)
 {
-    return (server? server->pipename : FIFO_NAME_LINUX_DEFAULT);
+    char buf[256];
+
+    while (read(fd, buf, sizeof(buf)) == sizeof(buf)) {
+        /* more doorbells */
+    }
 }
 
 
-void fifo_server_runforever (fifo_server server, fifo_onpipemsg_cb pipemsgcb, void *argument, fifo_serverloop_cb servloopcb, void *loopcbarg)
+static int64_t monotonic_usec (void)
 {
-    int client_fifolen;
-    char client_fifo[FIFO_NAMELEN_MAX + 1];
+    struct timespec now;
 
-    int rc;
-    fd_set rfds;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    fifo_pipemsg_t clientmsg;
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
-    snprintf(client_fifo, FIFO_NAMELEN_MAX, "%.*s", server->namelen, server->pipename);
-    client_fifo[FIFO_NAMELEN_MAX] = 0;
 
-    // TODO: SIGPIPE
+/**
+ * shmring_doorbell()
+ *   wake up consumer if it sleeps. the fence pairs with the one in
+ *   shmring_sleep(): either consumer sees new tail or we see waiting.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error, consumer is gone
+ */
+static int shmring_doorbell (fifo_shmend_t *end)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    while(! servloopcb || servloopcb(loopcbarg)) {
-        FD_ZERO(&rfds);
-        FD_SET(server->accept_pipefd, &rfds);
+    if (__atomic_load_n(&end->ring->waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&end->ring->waiting, 0, __ATOMIC_ACQ_REL)) {
+        int32_t head = (int32_t) FIFO_FRAME_F_DOORBELL;
 
-        if (server->connect_timeout.tv_sec < 0) {
-            rc = select((int)server->accept_pipefd + 1, &rfds, NULL, NULL, NULL);
-        } else {
-            rc = select((int)server->accept_pipefd + 1, &rfds, NULL, NULL, &server->connect_timeout);
+        // pipe full of doorbells wakes up consumer anyway
+        if (write(end->doorbellfd, &head, sizeof(head)) == -1 && errno != EAGAIN) {
+            printf("write error: %s.\n", strerror(errno));
+            return (-1);
         }
+    }
 
-        if (rc == 1) {
-            if (readpipemsg_nb(server->accept_pipefd, &clientmsg) == 0 && clientmsg.msgsz > 0) {
-                pthread_t thread;
+    return 0;
+}
 
-                client_fifolen = snprintf(client_fifo + server->namelen, FIFO_NAMELEN_MAX - server->namelen,
-                                    "%.*s", (int)clientmsg.msgsz, clientmsg.msgbuf);
 
-                client_fifolen += server->namelen;
+// reader of doorbell pipe closed it: consumer is gone
+static int shmring_peer_gone (fifo_shmend_t *end)
+{
+    struct pollfd pfd;
 
-                printf("message from client: {%.*s}\n", client_fifolen, client_fifo);
+    pfd.fd = end->doorbellfd;
+    pfd.events = 0;
+    pfd.revents = 0;
 
-                int requestfd = open(client_fifo, O_NONBLOCK|O_RDWR);
-                if (requestfd == -1) {
-                    printf("open fifo failed: %s - %s.\n", strerror(errno), client_fifo);
-                    continue;
-                }
+    return (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLERR));
+}
 
-                printf("client connect on pipe: {%.*s}\n", client_fifolen, client_fifo);
 
-                strcat(client_fifo, "-read");
-                int replyfd = open(client_fifo, O_WRONLY);
-                if (replyfd == -1) {
-                    printf("open fifo failed: %s - %s.\n", strerror(errno), client_fifo);
-                    close(requestfd);
-                    continue;
-                }
+/**
+ * shmring_sleep()
+ *   consumer tells producer it goes to sleep on doorbell pipe.
+ *
+ * returns:
+ *   1: ring is empty and consumer may sleep
+ *   0: data arrived meanwhile
+ */
+static int shmring_sleep (fifo_shmend_t *end)
+{
+    __atomic_store_n(&end->ring->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-                pipe_instance_t *pipeinst = pipe_instance_new(requestfd, replyfd, pipemsgcb, argument, server);
+    if (__atomic_load_n(&end->ring->tail, __ATOMIC_ACQUIRE) != end->ring->head) {
+        __atomic_store_n(&end->ring->waiting, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
 
-                if (pthread_create(&thread, NULL, client_fifo_worker, (void*)pipeinst) == -1) {
-                    printf("pthread_create failed.\n");
+    return 1;
+}
 
-                    close(requestfd);
-                    close(replyfd);
 
-                    pipe_instance_free(pipeinst);
-                    break;
-                }
-            }
-        } else if (rc == 0) {
-            // timeout with no ready
-            printf(".");
-        } else {
-            printf("select failed: %s.\n", strerror(errno));
+/**
+ * shmring_copy()
+ *   copy as much of src as ring has room for at tail, which is moved
+ *   on but not published.
+ *
+ * returns:
+ *   bytes copied
+ */
+static size_t shmring_copy (fifo_shmend_t *end, uint64_t *tail, const char *src, size_t len)
+{
+    size_t copied = 0;
+
+    while (len > 0) {
+        size_t off, cb;
+        size_t room = end->size - (size_t) (*tail - __atomic_load_n(&end->ring->head, __ATOMIC_ACQUIRE));
+
+        if (room == 0) {
             break;
         }
+
+        off = (size_t) (*tail & (end->size - 1));
+
+        cb = (len < room? len : room);
+        if (cb > end->size - off) {
+            cb = end->size - off;
+        }
+
+        memcpy(end->data + off, src, cb);
+
+        src += cb;
+        len -= cb;
+        *tail += cb;
+        copied += cb;
     }
 
-    exit(EXIT_FAILURE);
+    return copied;
 }
 
 
-int fifo_client_new (const char *pathname, int wait_timeout, fifo_client *client)
+/**
+ * shmring_trywritev()
+ *   copy as much of iov as ring has room for and ring the doorbell.
+ *   never waits, like writev() on a non-blocking pipe.
+ *
+ * returns:
+ *   bytes copied, or -1 with errno EAGAIN if ring is full, or with
+ *   errno of doorbell if consumer is gone.
+ */
+static ssize_t shmring_trywritev (fifo_shmend_t *end, const struct iovec *iov, int iovcnt)
 {
-    fifo_client_t *clnt;
+    int i, full = 0;
+    size_t copied = 0;
+    uint64_t tail = end->ring->tail;
 
-    int writefd, readfd, namelen, pipelen;
+    for (i = 0; i < iovcnt && ! full; i++) {
+        size_t cb = shmring_copy(end, &tail, (const char *) iov[i].iov_base, iov[i].iov_len);
 
-    char client_pipename[FIFO_NAMELEN_MAX + 1];
-    const char *pipename;
+        copied += cb;
+        full = (cb < iov[i].iov_len);
+    }
 
-    fifo_pipemsg_t clientmsg;
+    if (copied == 0) {
+        if (full) {
+            errno = EAGAIN;
+            return (-1);
+        }
+        return 0;
+    }
 
-    // pid = 12345
-    pid_t pid = getpid();
+    __atomic_store_n(&end->ring->tail, tail, __ATOMIC_RELEASE);
 
-    // pipename = "/tmp/namedpipe-default"
-    pipename = pathname? pathname : FIFO_NAME_LINUX_DEFAULT;
-    namelen = (int) strnlen(pipename, FIFO_NAMELEN_MAX - 20);
-    if (namelen == FIFO_NAMELEN_MAX - 20) {
-        printf("Invalid pipe name: %s.\n", pipename);
-        return FIFO_E_FAILED;
+    if (shmring_doorbell(end) != 0) {
+        return (-1);
     }
 
-    // client_pipename = "/tmp/namedpipe-default.12345"
-    pipelen = snprintf(client_pipename, FIFO_NAMELEN_MAX, "%.*s.%d", namelen, pipename, pid);
+    return (ssize_t) copied;
+}
+
+
+/**
+ * shmring_writev()
+ *   copy iov into ring and ring the doorbell. producer waits for room
+ *   if ring is full, but no longer than waitusec without the consumer
+ *   reading any (-1 for no limit).
+ *
+ * returns:
+ *    0: success
+ *   -1: consumer is gone or timed out
+ */
+static int shmring_writev (fifo_shmend_t *end, const struct iovec *iov, int iovcnt, int64_t waitusec)
+{
+    int i, spins = 0;
+    int64_t since = 0;
+    fifo_shmring_t *ring = end->ring;
+    uint64_t tail = ring->tail;
+
+    for (i = 0; i < iovcnt; i++) {
+        const char *src = (const char *) iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len > 0) {
+            size_t cb = shmring_copy(end, &tail, src, len);
+
+            src += cb;
+            len -= cb;
+
+            if (cb > 0) {
+                since = 0;
+                continue;
+            }
+
+            // publish what we have and let consumer drain
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+            if (shmring_doorbell(end) != 0) {
+                return (-1);
+            }
+
+            if (waitusec >= 0 && since == 0) {
+                since = monotonic_usec();
+            }
+
+            if (spins++ < FIFO_SHM_SPINS) {
+                sched_yield();
+            } else if (shmring_peer_gone(end)) {
+                printf("shared memory peer is gone.\n");
+                return (-1);
+            } else if (waitusec >= 0 && monotonic_usec() - since > waitusec) {
+                printf("shared memory ring full: timed out.\n");
+                return (-1);
+            } else {
+                usleep(100);
+            }
+        }
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    return shmring_doorbell(end);
+}
+
+
+// free bytes in ring for producer
+static size_t shmring_room (fifo_shmend_t *end)
+{
+    return end->size - (size_t) (end->ring->tail - __atomic_load_n(&end->ring->head, __ATOMIC_ACQUIRE));
+}
+
+
+/**
+ * shmring_read()
+ *   copy up to room bytes out of ring. *more is set if ring has more.
+ *
+ * returns:
+ *   bytes copied
+ */
+static int shmring_read (fifo_shmend_t *end, char *dst, int room, int *more)
+{
+    size_t off, avail, cb, first;
+    fifo_shmring_t *ring = end->ring;
+    uint64_t head = ring->head;
+
+    // woken up or never slept
+    if (ring->waiting) {
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    avail = (size_t) (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head);
+
+    cb = (avail < (size_t) room? avail : (size_t) room);
+    off = (size_t) (head & (end->size - 1));
+
+    first = (cb < end->size - off? cb : end->size - off);
+
+    memcpy(dst, end->data + off, first);
+    memcpy(dst + first, end->data, cb - first);
+
+    __atomic_store_n(&ring->head, head + cb, __ATOMIC_RELEASE);
+
+    *more = (avail > cb);
+    return (int) cb;
+}
+
+
+/**
+ * fifo_outq_t
+ *   reply bytes a non-blocking reply pipe had no room for. they go out
+ *   before any later reply when epoll reports the pipe writable again.
+ *   the pipe is referenced as long as EPOLLOUT is armed.
+ *
+ *   with shm, replies go to the shared memory ring instead. a full ring
+ *   has no event for room, so a one-shot timerfd looks again at what the
+ *   client has read.
+ */
+typedef struct
+{
+    char *buf;
+    size_t head;
+    size_t len;
+    size_t bufsz;
+
+    // reply pipe, polled by epollfd. -1 if pipe has no reactor: writes
+    //   then wait for room in place
+    int fd;
+    int epollfd;
+
+    int registered;
+    int armed;
+
+    // write error seen: all of later writes fail
+    int failed;
+
+    // data of EPOLLOUT event and refcount of pipe
+    void *evdata;
+    int *refc;
+
+    // ring replies go to if not null. fd then only carries doorbells
+    fifo_shmend_t *shm;
+    int timerfd;
+
+    // client which reads nothing of a full ring for waitusec since
+    //   since is gone. -1 waits forever
+    int64_t waitusec;
+    int64_t since;
+} fifo_outq_t;
+
+
+/**
+ * outq_arm()
+ *   get EPOLLOUT of reply pipe once, or expiry of timerfd with shm.
+ */
+static int outq_arm (fifo_outq_t *outq)
+{
+#ifdef FIFO_HAVE_EPOLL
+    struct epoll_event ev;
+    int fd = outq->fd;
+
+    ev.events = EPOLLOUT | EPOLLONESHOT;
+    ev.data.ptr = outq->evdata;
+
+    if (outq->shm) {
+        struct itimerspec its;
+
+        if (outq->timerfd == -1) {
+            outq->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+            if (outq->timerfd == -1) {
+                printf("timerfd_create failed: %s.\n", strerror(errno));
+                return (-1);
+            }
+        }
+
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_nsec = FIFO_SHM_RETRY_USEC * 1000;
+
+        if (timerfd_settime(outq->timerfd, 0, &its, NULL) == -1) {
+            printf("timerfd_settime failed: %s.\n", strerror(errno));
+            return (-1);
+        }
+
+        fd = outq->timerfd;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+    }
+
+    if (epoll_ctl(outq->epollfd, (outq->registered? EPOLL_CTL_MOD : EPOLL_CTL_ADD), fd, &ev) == -1) {
+        printf("epoll_ctl failed: %s.\n", strerror(errno));
+        return (-1);
+    }
+
+    outq->registered = 1;
+    outq->armed = 1;
+    return 0;
+#else
+    return (-1);
+#endif
+}
+
+
+static void outq_append (fifo_outq_t *outq, const char *data, size_t size)
+{
+    if (outq->head + outq->len + size > outq->bufsz) {
+        if (outq->head > 0) {
+            memmove(outq->buf, outq->buf + outq->head, outq->len);
+            outq->head = 0;
+        }
+
+        if (outq->len + size > outq->bufsz) {
+            size_t newsz = (outq->bufsz? outq->bufsz : PIPEMSG_SIZE_MAX);
+
+            while (newsz < outq->len + size) {
+                newsz *= 2;
+            }
+
+            outq->buf = (char *) mem_realloc(outq->buf, newsz);
+            outq->bufsz = newsz;
+        }
+    }
+
+    memcpy(outq->buf + outq->head + outq->len, data, size);
+    outq->len += size;
+}
+
+
+// write iov to ring with shm, else to pipe
+static ssize_t outq_trywritev (fifo_outq_t *outq, const struct iovec *iov, int iovcnt)
+{
+    if (outq->shm) {
+        return shmring_trywritev(outq->shm, iov, iovcnt);
+    }
+
+    return writev(outq->fd, iov, iovcnt);
+}
+
+
+/**
+ * outq_stalled()
+ *   shm ring stays full: client is taken as gone if it closed reply
+ *   pipe or read nothing for waitusec. errno is set then.
+ */
+static int outq_stalled (fifo_outq_t *outq)
+{
+    if (! outq->shm) {
+        return 0;
+    }
+
+    if (shmring_peer_gone(outq->shm)) {
+        errno = EPIPE;
+        return 1;
+    }
+
+    if (outq->waitusec >= 0 && monotonic_usec() - outq->since > outq->waitusec) {
+        errno = ETIMEDOUT;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * outq_writev()
+ *   write iov to reply pipe (or shm ring) after bytes queued before.
+ *   what it has no room for is queued and EPOLLOUT (or timerfd) armed,
+ *   so caller never blocks.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int outq_writev (fifo_outq_t *outq, struct iovec *iov, int iovcnt)
+{
+    int i;
+
+    if (outq->failed) {
+        return (-1);
+    }
+
+    if (outq->epollfd == -1) {
+        if (outq->shm) {
+            return shmring_writev(outq->shm, iov, iovcnt, outq->waitusec);
+        }
+        return writev_all(outq->fd, iov, iovcnt);
+    }
+
+    if (outq->len == 0) {
+        while (iovcnt > 0) {
+            ssize_t cb = outq_trywritev(outq, iov, iovcnt);
+
+            if (cb == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (errno == EAGAIN) {
+                    break;
+                }
+
+                printf("write error: %s.\n", strerror(errno));
+                outq->failed = 1;
+                return (-1);
+            }
+
+            iov_advance(&iov, &iovcnt, (size_t) cb);
+        }
+
+        if (iovcnt == 0) {
+            return 0;
+        }
+
+        outq->since = monotonic_usec();
+
+        if (! outq->armed) {
+            if (outq_arm(outq) != 0) {
+                outq->failed = 1;
+                return (-1);
+            }
+
+            __atomic_add_fetch(outq->refc, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        outq_append(outq, (const char *) iov[i].iov_base, iov[i].iov_len);
+    }
+
+    return 0;
+}
+
+
+/**
+ * outq_flush()
+ *   write queued bytes as far as reply pipe takes them.
+ *
+ * returns:
+ *    0: all written
+ *    1: pipe full, some left
+ *   -1: write error, queued bytes dropped
+ */
+static int outq_flush (fifo_outq_t *outq)
+{
+    size_t queued = outq->len;
+
+    while (outq->len > 0) {
+        struct iovec iov;
+        ssize_t cb;
+
+        iov.iov_base = outq->buf + outq->head;
+        iov.iov_len = outq->len;
+
+        cb = outq_trywritev(outq, &iov, 1);
+
+        if (cb == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN && outq->len < queued) {
+                // client reads: wait for it again from now
+                outq->since = monotonic_usec();
+                return 1;
+            }
+
+            if (errno == EAGAIN && ! outq_stalled(outq)) {
+                return 1;
+            }
+
+            printf("write error: %s.\n", strerror(errno));
+            outq->failed = 1;
+            outq->len = 0;
+            return (-1);
+        }
+
+        outq->head += (size_t) cb;
+        outq->len -= (size_t) cb;
+    }
+
+    outq->head = 0;
+
+    // keep a small buffer for next time
+    if (outq->bufsz > FIFO_MSGBUF_KEEP) {
+        mem_free(outq->buf);
+        outq->buf = NULL;
+        outq->bufsz = 0;
+    }
+
+    return 0;
+}
+
+
+/**
+ * wire_writev()
+ *   write iov through outq of server pipe if given, which knows its
+ *   shared memory ring. otherwise client writes to shm ring if given,
+ *   else to pipe fd.
+ */
+static int wire_writev (int fd, fifo_shmend_t *shm, fifo_outq_t *outq, struct iovec *iov, int iovcnt)
+{
+    if (outq) {
+        return outq_writev(outq, iov, iovcnt);
+    }
+
+    if (shm) {
+        return shmring_writev(shm, iov, iovcnt, -1);
+    }
+
+    return writev_all(fd, iov, iovcnt);
+}
+
+
+/**
+ * frame_write()
+ *   write msg as one frame in one syscall, so it is atomic on pipe.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int frame_write (int fd, fifo_shmend_t *shm, fifo_outq_t *outq, fifo_pipemsg_t *msg, const fifo_frame_t *frame)
+{
+    char hdr[8];
+    struct iovec iov[2];
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = frame_pack_header(hdr, msg, frame);
+
+    iov[1].iov_base = msg->msgbuf;
+    iov[1].iov_len = msg->msgsz;
+
+    return wire_writev(fd, shm, outq, iov, 2);
+}
+
+
+/**
+ * frame_writev_chunks()
+ *   write msgsz bytes gathered from src as chunk frames of one msg. every
+ *   chunk is a whole frame of PIPEMSG_SIZE_MAX bytes at most and all but
+ *   the last one has FIFO_FRAME_F_MORE. headers and pieces of src go in
+ *   writev of FIFO_CHUNK_IOV * 2 at most, so a msg fit in one frame from
+ *   a few pieces is one syscall. caller must make sure nobody else writes
+ *   to fd meanwhile.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int frame_writev_chunks (int fd, fifo_shmend_t *shm, fifo_outq_t *outq, const struct iovec *src, size_t msgsz, const fifo_frame_t *frame)
+{
+    int n = 0, nhdrs = 0;
+    size_t off = 0, left = 0;
+
+    char hdrs[FIFO_CHUNK_IOV][8];
+    struct iovec iov[FIFO_CHUNK_IOV * 2];
+
+    uint32_t flags = frame->flags & FIFO_FRAME_F_REQID;
+    size_t chunksz = PIPEMSG_SIZE_MAX - sizeof(int32_t) - ((flags & FIFO_FRAME_F_REQID)? sizeof(frame->reqid) : 0);
+
+    while (msgsz > 0) {
+        size_t cb;
+
+        if (n == FIFO_CHUNK_IOV * 2) {
+            if (wire_writev(fd, shm, outq, iov, n) != 0) {
+                return (-1);
+            }
+            n = nhdrs = 0;
+        }
+
+        if (left == 0) {
+            // every chunk has a piece after header, so hdrs never run out
+            left = (msgsz < chunksz? msgsz : chunksz);
+
+            iov[n].iov_base = hdrs[nhdrs];
+            iov[n].iov_len = frame_header(hdrs[nhdrs], flags | (left < msgsz? FIFO_FRAME_F_MORE : 0), frame->reqid, (int) left);
+            n++;
+            nhdrs++;
+            continue;
+        }
+
+        while (off == src->iov_len) {
+            src++;
+            off = 0;
+        }
+
+        cb = src->iov_len - off;
+        if (cb > left) {
+            cb = left;
+        }
+
+        iov[n].iov_base = (char *) src->iov_base + off;
+        iov[n].iov_len = cb;
+        n++;
+
+        off += cb;
+        left -= cb;
+        msgsz -= cb;
+    }
+
+    if (n > 0 && wire_writev(fd, shm, outq, iov, n) != 0) {
+        return (-1);
+    }
+
+    return 0;
+}
+
+
+static int frame_write_chunks (int fd, fifo_shmend_t *shm, fifo_outq_t *outq, const char *msgbuf, size_t msgsz, const fifo_frame_t *frame)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *) msgbuf;
+    iov.iov_len = msgsz;
+
+    return frame_writev_chunks(fd, shm, outq, &iov, msgsz, frame);
+}
+
+
+int fifo_msgbuf_reserve (fifo_msgbuf_t *msg, size_t bufsz)
+{
+    if (bufsz > msg->bufsz) {
+        size_t newsz = (msg->bufsz? msg->bufsz : PIPEMSG_SIZE_MAX);
+
+        if (bufsz > FIFO_MSGBUF_MAX) {
+            printf("msg too large: %" PRIu64 " bytes.\n", (uint64_t) bufsz);
+            return FIFO_E_BADARG;
+        }
+
+        while (newsz < bufsz) {
+            newsz *= 2;
+        }
+        if (newsz > FIFO_MSGBUF_MAX) {
+            newsz = FIFO_MSGBUF_MAX;
+        }
+
+        msg->msgbuf = (char *) mem_realloc(msg->msgbuf, newsz);
+        msg->bufsz = newsz;
+    }
+
+    return FIFO_S_OK;
+}
+
+
+void fifo_msgbuf_free (fifo_msgbuf_t *msg)
+{
+    mem_free(msg->msgbuf);
+
+    msg->msgbuf = NULL;
+    msg->bufsz = 0;
+    msg->msgsz = 0;
+}
+
+
+static int msgbuf_append (fifo_msgbuf_t *msg, const char *data, size_t size)
+{
+    if (fifo_msgbuf_reserve(msg, msg->msgsz + size) != FIFO_S_OK) {
+        return (-1);
+    }
+
+    memcpy(msg->msgbuf + msg->msgsz, data, size);
+    msg->msgsz += size;
+
+    return 0;
+}
+
+
+// msg is done: keep a small buffer for next one
+static void msgbuf_reset (fifo_msgbuf_t *msg)
+{
+    if (msg->bufsz > FIFO_MSGBUF_KEEP) {
+        fifo_msgbuf_free(msg);
+    }
+
+    msg->msgsz = 0;
+}
+
+
+/**
+ * fifo_txbuf_t
+ *   reply frames packed to go out in one write. never exceeds
+ *   PIPEMSG_SIZE_MAX, so the write is atomic with frames written by
+ *   workers to the same pipe.
+ */
+typedef struct
+{
+    int len;
+    char buf[PIPEMSG_SIZE_MAX];
+} fifo_txbuf_t;
+
+
+static int txbuf_flush (fifo_txbuf_t *tx, int fd, fifo_shmend_t *shm, fifo_outq_t *outq)
+{
+    if (tx->len > 0) {
+        struct iovec iov;
+
+        iov.iov_base = tx->buf;
+        iov.iov_len = tx->len;
+
+        tx->len = 0;
+
+        return wire_writev(fd, shm, outq, &iov, 1);
+    }
+
+    return 0;
+}
+
+
+/**
+ * txbuf_pack()
+ *   append msg as a frame to txbuf.
+ *
+ * returns:
+ *    0: success
+ *   -1: no room, flush txbuf and try again
+ */
+static int txbuf_pack (fifo_txbuf_t *tx, fifo_pipemsg_t *msg, const fifo_frame_t *frame)
+{
+    char hdr[8];
+    int hdrsz = frame_pack_header(hdr, msg, frame);
+
+    if (tx->len + hdrsz + msg->msgsz > (int) sizeof(tx->buf)) {
+        return (-1);
+    }
+
+    memcpy(tx->buf + tx->len, hdr, hdrsz);
+    memcpy(tx->buf + tx->len + hdrsz, msg->msgbuf, msg->msgsz);
+    tx->len += hdrsz + msg->msgsz;
+
+    return 0;
+}
+
+
+/**
+ * fifo_rxbuf_t
+ *   receive buffer of a pipe. bytes in [head, tail) are received but not
+ *   decoded yet. a partial frame is kept across reads and moved to the
+ *   front only when there is no room for a whole frame after it.
+ */
+typedef struct
+{
+    int head;
+    int tail;
+
+    char buf[FIFO_RXBUF_SIZE];
+} fifo_rxbuf_t;
+
+
+static fifo_rxbuf_t * rxbuf_new (void)
+{
+    fifo_rxbuf_t *rx = (fifo_rxbuf_t *) mem_alloc_unset(sizeof(*rx));
+
+    rx->head = rx->tail = 0;
+    return rx;
+}
+
+
+/**
+ * rxbuf_room()
+ *   get free space at tail for next read.
+ */
+static int rxbuf_room (fifo_rxbuf_t *rx, char **room)
+{
+    if (rx->head == rx->tail) {
+        rx->head = rx->tail = 0;
+    } else if (FIFO_RXBUF_SIZE - rx->head < PIPEMSG_SIZE_MAX) {
+        memmove(rx->buf, rx->buf + rx->head, rx->tail - rx->head);
+        rx->tail -= rx->head;
+        rx->head = 0;
+    }
+
+    *room = rx->buf + rx->tail;
+    return FIFO_RXBUF_SIZE - rx->tail;
+}
+
+
+/**
+ * rxbuf_read()
+ *   read as much as available from non-blocking fd in one syscall.
+ *   *more is set if the read filled all room so pipe may have more.
+ *
+ * returns:
+ *   >0: bytes read
+ *    0: nothing to read (EAGAIN)
+ *   -1: end of pipe or read error
+ */
+static int rxbuf_read (fifo_rxbuf_t *rx, int fd, int *more)
+{
+    char *room;
+    int roomsz = rxbuf_room(rx, &room);
+
+    ssize_t count = read(fd, room, roomsz);
+
+    if (count > 0) {
+        rx->tail += (int) count;
+        *more = (count == roomsz);
+        return (int) count;
+    }
+
+    *more = 0;
+
+    if (count == -1 && errno == EAGAIN) {
+        return 0;
+    }
+
+    return (-1);
+}
+
+
+/**
+ * rxbuf_read_shm()
+ *   same as rxbuf_read() but from shared memory ring.
+ */
+static int rxbuf_read_shm (fifo_rxbuf_t *rx, fifo_shmend_t *end, int *more)
+{
+    char *room;
+    int roomsz = rxbuf_room(rx, &room);
+
+    int count = shmring_read(end, room, roomsz, more);
+
+    rx->tail += count;
+    return count;
+}
+
+
+/**
+ * rxbuf_next()
+ *   get next complete frame in rxbuf with body as a view into rxbuf,
+ *   which is valid until rxbuf is read again.
+ *
+ * returns:
+ *    1: got a msg
+ *    0: need more bytes
+ *   -1: bad frame
+ */
+static int rxbuf_next (fifo_rxbuf_t *rx, const char **body, int *bodysz, fifo_frame_t *frame)
+{
+    int32_t head;
+    int msgsz, hdrsz = (int) sizeof(head);
+    int avail = rx->tail - rx->head;
+
+    if (avail < hdrsz) {
+        return 0;
+    }
+
+    memcpy(&head, rx->buf + rx->head, sizeof(head));
+
+    frame->flags = (uint32_t) head & ~FIFO_FRAME_SIZE_MASK;
+    frame->reqid = 0;
+
+    if (frame->flags & FIFO_FRAME_F_REQID) {
+        hdrsz += (int) sizeof(frame->reqid);
+    }
+
+    msgsz = (int) (head & FIFO_FRAME_SIZE_MASK);
+
+    if (head < 0 || (frame->flags & ~FIFO_FRAME_F_ALL) || hdrsz + msgsz > PIPEMSG_SIZE_MAX) {
+        printf("bad frame for msg: header=0x%08x\n", (unsigned int) head);
+        return (-1);
+    }
+
+    if (avail < hdrsz + msgsz) {
+        return 0;
+    }
+
+    if (frame->flags & FIFO_FRAME_F_REQID) {
+        memcpy(&frame->reqid, rx->buf + rx->head + sizeof(head), sizeof(frame->reqid));
+    }
+
+    *body = rx->buf + rx->head + hdrsz;
+    *bodysz = msgsz;
+
+    rx->head += hdrsz + msgsz;
+    return 1;
+}
+
+
+/**
+ * rxbuf_decode()
+ *   decode next complete frame in rxbuf into msg and frame.
+ */
+static int rxbuf_decode (fifo_rxbuf_t *rx, fifo_pipemsg_t *msg, fifo_frame_t *frame)
+{
+    const char *body;
+    int bodysz;
+
+    int rc = rxbuf_next(rx, &body, &bodysz, frame);
+
+    if (rc == 1) {
+        msg->msgsz = bodysz;
+        memcpy(msg->msgbuf, body, bodysz);
+    }
+
+    return rc;
+}
+
+
+/**
+ * fifo_spin_t
+ *   adaptive busy-poll of a waiting thread. budget is twice the average
+ *   time waited for data up to maxusec, and none while data takes longer
+ *   than maxusec. time waited is learnt from blocking waits too, so the
+ *   budget comes back when data comes sooner again. a wait which spun in
+ *   vain counts double, and with one cpu there is no spinning at all:
+ *   the peer cannot run while we spin.
+ */
+typedef struct
+{
+    int maxusec;
+    int64_t avgwait;
+
+    // start of current wait and 1 if it spun in vain
+    int64_t waitstart;
+    int missed;
+
+    // counters of owner, shared by all of waiters of a server
+    fifo_spin_stats_t *stats;
+} fifo_spin_t;
+
+
+static void spin_init (fifo_spin_t *spin, int maxusec, fifo_spin_stats_t *stats)
+{
+    spin->maxusec = (sysconf(_SC_NPROCESSORS_ONLN) > 1? maxusec : 0);
+    spin->avgwait = maxusec / 2;
+    spin->waitstart = 0;
+    spin->missed = 0;
+    spin->stats = stats;
+}
+
+
+// data came or wait timed out after blocking: learn time waited
+static void spin_waited (fifo_spin_t *spin)
+{
+    if (spin->maxusec) {
+        int64_t waited = (monotonic_usec() - spin->waitstart) << spin->missed;
+
+        spin->avgwait += (waited - spin->avgwait) / 8;
+    }
+}
+
+
+/**
+ * spin_poll()
+ *   start a wait: call pollfn until it returns nonzero or budget runs
+ *   out. caller blocks if it returns 0, then calls spin_waited().
+ *
+ * returns:
+ *   last result of pollfn.
+ */
+static int spin_poll (fifo_spin_t *spin, int (*pollfn) (void *arg), void *arg)
+{
+    int rc = 0;
+    int64_t budget, now;
+
+    spin->waitstart = now = monotonic_usec();
+
+    budget = (spin->avgwait > spin->maxusec? 0 : spin->avgwait * 2 + 1);
+    if (budget > spin->maxusec) {
+        budget = spin->maxusec;
+    }
+
+    spin->stats->budget = (int) budget;
+    spin->missed = 0;
+
+    if (budget == 0) {
+        return 0;
+    }
+
+    while ((rc = pollfn(arg)) == 0 && (now = monotonic_usec()) - spin->waitstart < budget) {
+        // spin
+    }
+
+    if (rc != 0) {
+        now = monotonic_usec();
+        spin->avgwait += (now - spin->waitstart - spin->avgwait) / 8;
+
+        __atomic_add_fetch(&spin->stats->hits, 1, __ATOMIC_RELAXED);
+    } else {
+        spin->missed = 1;
+
+        __atomic_add_fetch(&spin->stats->misses, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&spin->stats->spinusec, (uint64_t) (now - spin->waitstart), __ATOMIC_RELAXED);
+
+    return rc;
+}
+
+
+/**
+ * fifo_task_t
+ *   intrusive task node queued to worker pool.
+ */
+typedef struct _fifo_task_t
+{
+    struct _fifo_task_t *next;
+
+    void (*taskfn) (struct _fifo_task_t *task);
+} fifo_task_t;
+
+
+/**
+ * fifo_runq_t
+ *   run queue of a worker which steals. cache line aligned so workers
+ *   never share one.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+
+    fifo_task_t *head;
+    fifo_task_t *tail;
+    int count;
+
+    // picks victims to steal from, by owner only
+    unsigned int seed;
+} __attribute__((aligned(64))) fifo_runq_t;
+
+
+/**
+ * fifo_workpool_t
+ *   fixed size pool of pre-spawned worker threads with a FIFO task queue,
+ *   or with a run queue per worker and stealing among them.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    fifo_task_t *head;
+    fifo_task_t *tail;
+
+    int stopping;
+
+    // stealing: tasks in all of runqs and workers asleep on cond
+    int nrunqs;
+    fifo_runq_t *runqs;
+    int queued;
+    int idle;
+
+    // next runq for tasks from outside of workers, and index of workers
+    unsigned int nextq;
+    int started;
+
+    int numworkers;
+    pthread_t workers[0];
+} fifo_workpool_t;
+
+
+typedef struct _fifo_reactor_t
+{
+    int epollfd;
+    int index;
+
+    // accept pipe (lane) owned by this reactor if sharded
+    int lane_pipefd;
+    fifo_rxbuf_t *lane_rx;
+
+    // reactor thread was started and is joined by fifo_server_free
+    pthread_t thread;
+    int started;
+
+    // pipeline: requests done by workers, pushed by them and taken all
+    //   at once by reactor when donefd (eventfd) fires. it also wakes up
+    //   reactor to stop.
+    int donefd;
+    struct _fifo_task_t *donelist;
+
+    fifo_spin_t spin;
+
+#ifdef FIFO_USE_IO_URING
+    // null if io_uring not available
+    iouring_t *ring;
+
+    int txlen;
+    char *txbuf;
+#endif
+
+    struct _fifo_server_t *server;
+} fifo_reactor_t;
+
+
+typedef struct _fifo_server_t
+{
+    // O_NONBLOCK|O_RDWR
+    int accept_pipefd;
+    fifo_rxbuf_t *accept_rx;
+
+    // config settings
+    struct timeval client_timeout;
+    struct timeval connect_timeout;
+
+    // FIFO_SERVER_MODE_THREADS or FIFO_SERVER_MODE_REACTOR
+    int mode;
+
+    // reactors[0] is driven by fifo_server_runforever
+    int sharded;
+    int numreactors;
+    unsigned int nextreactor;
+    fifo_reactor_t *reactors;
+
+    // 1: reactors stop on wakeup by fifo_server_free
+    int stopping;
+
+    // run handlers for ready pipes if not null
+    int numworkers;
+    int steal;
+    fifo_workpool_t *workpool;
+
+    // 1: reactors do i/o only, handlers run in workpool
+    int pipeline;
+
+    // max us of busy-poll and counters of all of reactors and pipes
+    int busypoll;
+    fifo_spin_stats_t spinstats;
+
+    // cpus server threads run on (none if numcpus is 0), all cpus server
+    //   may run on, 1: run reply path on cpu of client
+    int numcpus;
+    int *cpus;
+    cpu_set_t cpuallowed;
+    int colocate;
+
+    // pre-fork: number of worker processes and lock of accept pipe in
+    //   memory shared by them, null if none
+    int processes;
+    pthread_mutex_t *acceptlock;
+
+    // process which created server and owns its pipes
+    pid_t owner;
+
+    fifo_onpipemsg_cb pipemsgcb;
+    fifo_onmsgbuf_cb msgbufcb;
+    fifo_onmsgview_cb viewcb;
+    fifo_onpipemsgs_cb pipemsgscb;
+    fifo_onnotify_cb notifycb;
+    void *argument;
+
+    int batchsize;
+
+    // The entire pipe name string can be up to 256 characters long.
+    // Pipe names are not case sensitive.
+    int namelen;
+    char pipename[0];
+} fifo_server_t;
+
+
+/**
+ * fifo_call_t
+ *   an outstanding async call of client.
+ */
+typedef struct _fifo_call_t
+{
+    // next call in same hash bucket
+    struct _fifo_call_t *hashnext;
+
+    // calls listed in send order, so the earliest expires first
+    struct _fifo_call_t *prev;
+    struct _fifo_call_t *next;
+
+    uint32_t reqid;
+
+    // expire time in ms of CLOCK_MONOTONIC, 0 for never
+    int64_t deadline;
+
+    fifo_onreply_cb replycb;
+    void *argument;
+} fifo_call_t;
+
+
+static mem_pool_t callpool = MEM_POOL_INITIALIZER(sizeof(fifo_call_t));
+
+
+typedef struct _fifo_client_t
+{
+    int readfd;
+    int writefd;
+
+    struct timeval wait_timeout;
+
+    // replies received but not yet returned
+    fifo_rxbuf_t *rx;
+
+    uint32_t nextreqid;
+
+    // async calls hashed by reqid, allocated on first call
+    fifo_call_t **calls;
+    fifo_call_t *callhead;
+    fifo_call_t *calltail;
+    int numcalls;
+
+    // shared memory rings if server attached
+    fifo_shm_t *shm;
+
+    // requests coalesced up to coalesce bytes if not null
+    fifo_txbuf_t *tx;
+    int coalesce;
+
+    // linger in us (-1 for no limit) and max it adapts up to
+    int linger;
+    int lingermax;
+    int adaptive;
+
+    // when first request in tx was buffered, and that of last requests
+    //   flushed until a reply arrives
+    int64_t txstart;
+    int64_t flushstart;
+
+    // average latency in us of replies to coalesced requests
+    int64_t latency;
+
+    // one-way msgs: sequence number of last sent and acked, lost ones
+    uint32_t notifyseq;
+    uint32_t acked;
+    uint32_t lost;
+
+    // busy-poll of reply pipe if spin.maxusec
+    fifo_spin_t spin;
+    fifo_spin_stats_t spinstats;
+
+    int namelen;
+    char pipename[0];
+} fifo_client_t;
+
+
+static fifo_call_t * client_call_unlink (fifo_client client, uint32_t reqid);
+
+
+typedef struct
+{
+    // must be the first member
+    fifo_task_t task;
+
+    // pipe is freed when last reference released
+    int refc;
+
+    int requestfd;
+    int replyfd;
+
+    // serializes writes to replyfd by reactor and workers, so chunks of a
+    //   large reply are never interleaved with other frames
+    pthread_mutex_t txlock;
+
+    // replies reply pipe of reactor had no room for, and task of EPOLLOUT
+    //   which writes them. under txlock.
+    fifo_outq_t outq;
+    fifo_task_t txtask;
+
+    // request pipe not rearmed until outq is written. under txlock.
+    int rxpaused;
+
+    // not null if client msgs go through shared memory
+    fifo_shm_t *shm;
+
+    // reactor which owns this pipe in FIFO_SERVER_MODE_REACTOR
+    fifo_reactor_t *reactor;
+
+    struct timeval timeout;
+
+    // borrowed from pools while pipe is active. rxbuf is kept as long
+    //   as it holds a partial msg.
+    fifo_rxbuf_t *rx;
+    fifo_pipemsg_t *request;
+    fifo_pipemsg_t *reply;
+
+    // large request being assembled and reply to it
+    fifo_msgbuf_t bigrequest;
+    fifo_msgbuf_t bigreply;
+
+    fifo_onpipemsg_cb pipemsgcb;
+    fifo_onmsgbuf_cb msgbufcb;
+    fifo_onmsgview_cb viewcb;
+    fifo_onpipemsgs_cb pipemsgscb;
+    fifo_onnotify_cb notifycb;
+    void *argument;
+
+    int batchsize;
+    int pipeline;
+
+    // busy-poll of pipe thread in FIFO_SERVER_MODE_THREADS
+    int busypoll;
+    fifo_spin_stats_t *spinstats;
+
+    // pipeline: requests without id run one at a time in order. the
+    //   rest wait here. touched by reactor thread only.
+    int serialbusy;
+    fifo_task_t *serialhead;
+    fifo_task_t *serialtail;
+
+    // one-way msgs: sequence number expected next, lost ones, received
+    //   since last ack
+    uint32_t notifyseq;
+    uint32_t notifylost;
+    int unacked;
+
+    // cpu client ran on when it connected, -1 if unknown
+    int cpu;
+} pipe_instance_t;
+
+
+/**
+ * pipe_request_t
+ *   a request with id handled by worker on its own, so that requests
+ *   of one pipe run in parallel and complete out of order.
+ */
+typedef struct
+{
+    // must be the first member
+    fifo_task_t task;
+
+    // reference held
+    pipe_instance_t *pipeinst;
+
+    fifo_frame_t frame;
+
+    // request buffer retained from pipe, no copy
+    fifo_pipemsg_t *request;
+    fifo_pipemsg_t *reply;
+
+    // pipeline: bytes of reply frames packed into reply buffer by viewcb
+    int txlen;
+
+    // pipeline: large msg assembled by reactor, owned by request
+    fifo_msgbuf_t bigrequest;
+
+    // pipeline: batch with requests without id, run in order with them
+    struct pipe_batch_t *batch;
+} pipe_request_t;
+
+
+/**
+ * fifo_reply_token_t
+ *   reply deferred by handler, completed by fifo_reply_send() later.
+ */
+struct fifo_reply_token_t
+{
+    // reference held until reply is sent
+    pipe_instance_t *pipeinst;
+
+    fifo_frame_t frame;
+};
+
+
+/**
+ * pipe_batch_t
+ *   requests of a pipe decoded in one wakeup for pipemsgscb. a batch of
+ *   requests all with id may run by worker like pipe_request_t.
+ */
+typedef struct pipe_batch_t
+{
+    // must be the first member
+    fifo_task_t task;
+
+    // reference held while queued to workers
+    pipe_instance_t *pipeinst;
+
+    int n;
+
+    // 1 if all of requests have id
+    int reqids;
+
+    fifo_frame_t frames[FIFO_BATCH_MAX];
+    fifo_pipemsg_t *requests[FIFO_BATCH_MAX];
+    fifo_pipemsg_t *replies[FIFO_BATCH_MAX];
+} pipe_batch_t;
+
+
+// per-pipe and per-msg objects of servers. a pipe borrows its buffers
+//   only while it has msgs to handle, so idle pipes hold none.
+static mem_pool_t pipeinstpool = MEM_POOL_INITIALIZER(sizeof(pipe_instance_t));
+static mem_pool_t requestpool = MEM_POOL_INITIALIZER(sizeof(pipe_request_t));
+static mem_pool_t batchpool = MEM_POOL_INITIALIZER(sizeof(pipe_batch_t));
+static mem_pool_t rxbufpool = MEM_POOL_INITIALIZER(sizeof(fifo_rxbuf_t));
+static mem_pool_t pipemsgpool = MEM_BUF_POOL_INITIALIZER(sizeof(fifo_pipemsg_t));
+static mem_pool_t tokenpool = MEM_POOL_INITIALIZER(sizeof(struct fifo_reply_token_t));
+
+
+// msg in a refcounted buffer
+static fifo_pipemsg_t * pipemsg_new (void)
+{
+    return (fifo_pipemsg_t *) mem_buf_alloc(&pipemsgpool)->data;
+}
+
+
+static void pipemsg_free (fifo_pipemsg_t *msg)
+{
+    mem_buf_release(mem_buf_of(msg));
+}
+
+
+const fifo_pipemsg_t * fifo_pipemsg_retain (const fifo_pipemsg_t *msg)
+{
+    mem_buf_retain(mem_buf_of(msg));
+    return msg;
+}
+
+
+void fifo_pipemsg_release (const fifo_pipemsg_t *msg)
+{
+    pipemsg_free((fifo_pipemsg_t *) msg);
+}
+
+
+// arena for requests handled by calling thread, created on first use
+static __thread mem_arena_t *request_arena = NULL;
+
+
+struct mem_arena_t * fifo_request_arena (void)
+{
+    if (! request_arena) {
+        request_arena = mem_arena_create(FIFO_ARENA_BLOCK);
+    }
+
+    return request_arena;
+}
+
+
+// reply is written: drop what handler allocated
+static void request_arena_reset (void)
+{
+    if (request_arena) {
+        mem_arena_reset(request_arena);
+    }
+}
+
+
+// thread handling requests exits
+static void request_arena_free (void)
+{
+    mem_arena_destroy(request_arena);
+    request_arena = NULL;
+}
+
+
+// run queue of calling thread if it is a worker which steals
+static __thread fifo_workpool_t *worker_pool = NULL;
+static __thread fifo_runq_t *worker_runq = NULL;
+
+
+static void runq_push (fifo_runq_t *runq, fifo_task_t *task)
+{
+    pthread_mutex_lock(&runq->lock);
+
+    if (runq->tail) {
+        runq->tail->next = task;
+    } else {
+        runq->head = task;
+    }
+    runq->tail = task;
+    runq->count++;
+
+    pthread_mutex_unlock(&runq->lock);
+}
+
+
+/**
+ * runq_steal()
+ *   take the older half of tasks from head of victim: the first one is
+ *   returned, the rest go to runq of thief. oldest tasks are stolen first
+ *   since they have waited longest.
+ */
+static fifo_task_t * runq_steal (fifo_runq_t *victim, fifo_runq_t *runq)
+{
+    int n;
+    fifo_task_t *task, *last;
+
+    if (! __atomic_load_n(&victim->count, __ATOMIC_RELAXED)) {
+        // nothing to steal: no lock taken
+        return NULL;
+    }
+
+    pthread_mutex_lock(&victim->lock);
+
+    task = victim->head;
+    if (! task) {
+        pthread_mutex_unlock(&victim->lock);
+        return NULL;
+    }
+
+    n = (victim->count + 1) / 2;
+    victim->count -= n;
+
+    for (last = task; --n > 0; last = last->next) {
+        // walk to last one stolen
+    }
+
+    victim->head = last->next;
+    if (! victim->head) {
+        victim->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&victim->lock);
+
+    last->next = NULL;
+
+    if (task != last) {
+        pthread_mutex_lock(&runq->lock);
+
+        if (runq->tail) {
+            runq->tail->next = task->next;
+        } else {
+            runq->head = task->next;
+        }
+        runq->tail = last;
+
+        for (last = task->next; last; last = last->next) {
+            runq->count++;
+        }
+
+        pthread_mutex_unlock(&runq->lock);
+    }
+
+    return task;
+}
+
+
+/**
+ * workpool_take()
+ *   next task for worker: from its own runq first, then stolen from other
+ *   runqs starting at a random one.
+ */
+static fifo_task_t * workpool_take (fifo_workpool_t *workpool, fifo_runq_t *runq)
+{
+    int i, start;
+    fifo_task_t *task = NULL;
+
+    if (__atomic_load_n(&runq->count, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&runq->lock);
+
+        task = runq->head;
+        if (task) {
+            runq->head = task->next;
+            if (! runq->head) {
+                runq->tail = NULL;
+            }
+            runq->count--;
+        }
+
+        pthread_mutex_unlock(&runq->lock);
+    }
+
+    // xorshift
+    runq->seed ^= runq->seed << 13;
+    runq->seed ^= runq->seed >> 17;
+    runq->seed ^= runq->seed << 5;
+
+    start = (int) (runq->seed % (unsigned int) workpool->nrunqs);
+
+    for (i = 0; ! task && i < workpool->nrunqs; i++) {
+        fifo_runq_t *victim = &workpool->runqs[(start + i) % workpool->nrunqs];
+
+        if (victim != runq) {
+            task = runq_steal(victim, runq);
+        }
+    }
+
+    if (task) {
+        __atomic_sub_fetch(&workpool->queued, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return task;
+}
+
+
+static void * workpool_steal_thread (void *arg)
+{
+    fifo_task_t *task;
+    fifo_workpool_t *workpool = (fifo_workpool_t *) arg;
+
+    int index = __atomic_fetch_add(&workpool->started, 1, __ATOMIC_RELAXED);
+
+    worker_pool = workpool;
+    worker_runq = &workpool->runqs[index];
+    worker_runq->seed = (unsigned int) index * 2654435761u + 1;
+
+    while (1) {
+        task = workpool_take(workpool, worker_runq);
+
+        if (! task) {
+            int stopping;
+
+            pthread_mutex_lock(&workpool->lock);
+
+            // pairs with workpool_push: either we see the task queued or
+            //   the pusher sees us idle and signals
+            __atomic_add_fetch(&workpool->idle, 1, __ATOMIC_SEQ_CST);
+
+            while (! __atomic_load_n(&workpool->queued, __ATOMIC_SEQ_CST) && ! workpool->stopping) {
+                pthread_cond_wait(&workpool->cond, &workpool->lock);
+            }
+
+            __atomic_sub_fetch(&workpool->idle, 1, __ATOMIC_SEQ_CST);
+
+            stopping = workpool->stopping && ! __atomic_load_n(&workpool->queued, __ATOMIC_SEQ_CST);
+
+            pthread_mutex_unlock(&workpool->lock);
+
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
+
+        task->next = NULL;
+        task->taskfn(task);
+    }
+
+    request_arena_free();
+    return NULL;
+}
+
+
+static void * workpool_thread (void *arg)
+{
+    fifo_task_t *task;
+    fifo_workpool_t *workpool = (fifo_workpool_t *) arg;
+
+    while (1) {
+        pthread_mutex_lock(&workpool->lock);
+
+        while (! workpool->head && ! workpool->stopping) {
+            pthread_cond_wait(&workpool->cond, &workpool->lock);
+        }
+
+        task = workpool->head;
+        if (task) {
+            workpool->head = task->next;
+            if (! workpool->head) {
+                workpool->tail = NULL;
+            }
+        }
+
+        pthread_mutex_unlock(&workpool->lock);
+
+        if (! task) {
+            // stopping
+            break;
+        }
+
+        task->next = NULL;
+        task->taskfn(task);
+    }
+
+    request_arena_free();
+    return NULL;
+}
+
+
+/**
+ * thread_cpuset()
+ *   make cpu set of cpus[0..numcpus).
+ *
+ * returns:
+ *   0 if no cpus given (no pinning), 1 otherwise.
+ */
+static int thread_cpuset (const int *cpus, int numcpus, cpu_set_t *cpuset)
+{
+    int i;
+
+    CPU_ZERO(cpuset);
+
+    for (i = 0; i < numcpus; i++) {
+        CPU_SET(cpus[i], cpuset);
+    }
+
+    return (numcpus > 0);
+}
+
+
+/**
+ * thread_create()
+ *   create a server thread named "fifo-name-index" (as shown by top -H,
+ *   perf and gdb) which runs on cpus[0..numcpus), or anywhere if none
+ *   or if it may not run there.
+ */
+static int thread_create (pthread_t *thread, void *(*startfn) (void *), void *arg, const char *name, int index, const int *cpus, int numcpus)
+{
+    int rc;
+    char thrname[16];
+    cpu_set_t cpuset;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+    if (thread_cpuset(cpus, numcpus, &cpuset)) {
+        pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+    }
+
+    rc = pthread_create(thread, &attr, startfn, arg);
+
+    pthread_attr_destroy(&attr);
+
+    if (rc == EINVAL && numcpus > 0) {
+        printf("pthread_create on cpu %d failed: fifo-%s-%d not pinned.\n", cpus[0], name, index);
+
+        rc = pthread_create(thread, NULL, startfn, arg);
+    }
+
+    if (rc == 0) {
+        snprintf(thrname, sizeof(thrname), "fifo-%s-%d", name, index);
+        pthread_setname_np(*thread, thrname);
+    }
+
+    return rc;
+}
+
+
+/**
+ * workpool_new()
+ *   start workers. worker k runs on cpus[(firstcpu + k) % numcpus] if
+ *   cpus given.
+ */
+static fifo_workpool_t * workpool_new (int numworkers, int steal, const int *cpus, int numcpus, int firstcpu)
+{
+    int i;
+    fifo_workpool_t *workpool = mem_alloc_zero(1, sizeof(*workpool) + sizeof(pthread_t) * numworkers);
+
+    pthread_mutex_init(&workpool->lock, NULL);
+    pthread_cond_init(&workpool->cond, NULL);
+
+    if (steal) {
+        workpool->nrunqs = numworkers;
+        workpool->runqs = (fifo_runq_t *) mem_alloc_zero(numworkers, sizeof(fifo_runq_t));
+
+        for (i = 0; i < numworkers; i++) {
+            pthread_mutex_init(&workpool->runqs[i].lock, NULL);
+        }
+    }
+
+    for (i = 0; i < numworkers; i++) {
+        if (thread_create(&workpool->workers[i], (steal? workpool_steal_thread : workpool_thread), (void*)workpool,
+                "worker", i, (numcpus? &cpus[(firstcpu + i) % numcpus] : NULL), (numcpus? 1 : 0)) != 0) {
+            printf("pthread_create failed.\n");
+            break;
+        }
+
+        workpool->numworkers++;
+    }
+
+    if (! workpool->numworkers) {
+        pthread_cond_destroy(&workpool->cond);
+        pthread_mutex_destroy(&workpool->lock);
+
+        for (i = 0; i < workpool->nrunqs; i++) {
+            pthread_mutex_destroy(&workpool->runqs[i].lock);
+        }
+
+        mem_free(workpool->runqs);
+        mem_free(workpool);
+        return NULL;
+    }
+
+    return workpool;
+}
+
+
+static void workpool_free (fifo_workpool_t *workpool)
+{
+    int i;
+
+    pthread_mutex_lock(&workpool->lock);
+    workpool->stopping = 1;
+    pthread_cond_broadcast(&workpool->cond);
+    pthread_mutex_unlock(&workpool->lock);
+
+    for (i = 0; i < workpool->numworkers; i++) {
+        // freed by exit in a handler: worker cannot wait for itself
+        if (! pthread_equal(workpool->workers[i], pthread_self())) {
+            pthread_join(workpool->workers[i], NULL);
+        }
+    }
+
+    pthread_cond_destroy(&workpool->cond);
+    pthread_mutex_destroy(&workpool->lock);
+
+    for (i = 0; i < workpool->nrunqs; i++) {
+        pthread_mutex_destroy(&workpool->runqs[i].lock);
+    }
+
+    mem_free(workpool->runqs);
+    mem_free(workpool);
+}
+
+
+/**
+ * workpool_push()
+ *   queue task to workers. with stealing, a task from a worker goes to
+ *   its own runq, others to runqs in turn. order among tasks is not kept
+ *   then, which callers never rely on: a pipe is handled by one thread
+ *   at a time (EPOLLONESHOT) and requests without id of a pipeline run
+ *   one at a time, so per-pipe order holds anyway.
+ */
+static void workpool_push (fifo_workpool_t *workpool, fifo_task_t *task)
+{
+    task->next = NULL;
+
+    if (workpool->runqs) {
+        fifo_runq_t *runq = worker_runq;
+
+        if (worker_pool != workpool) {
+            runq = &workpool->runqs[__atomic_fetch_add(&workpool->nextq, 1, __ATOMIC_RELAXED) % (unsigned int) workpool->nrunqs];
+        }
+
+        runq_push(runq, task);
+
+        __atomic_add_fetch(&workpool->queued, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&workpool->idle, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&workpool->lock);
+            pthread_cond_signal(&workpool->cond);
+            pthread_mutex_unlock(&workpool->lock);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&workpool->lock);
+
+    if (workpool->tail) {
+        workpool->tail->next = task;
+    } else {
+        workpool->head = task;
+    }
+    workpool->tail = task;
+
+    pthread_cond_signal(&workpool->cond);
+    pthread_mutex_unlock(&workpool->lock);
+}
+
+
+static pipe_instance_t * pipe_instance_new (int requestfd, int replyfd, fifo_server server)
+{
+    pipe_instance_t *pipeinst = (pipe_instance_t *) mem_pool_alloc(&pipeinstpool);
+
+    memset(pipeinst, 0, sizeof(*pipeinst));
+
+    pipeinst->refc = 1;
+
+    pipeinst->requestfd = requestfd;
+    pipeinst->replyfd = replyfd;
+
+    pthread_mutex_init(&pipeinst->txlock, NULL);
+
+    pipeinst->outq.fd = replyfd;
+    pipeinst->outq.epollfd = -1;
+    pipeinst->outq.evdata = &pipeinst->txtask;
+    pipeinst->outq.refc = &pipeinst->refc;
+    pipeinst->outq.timerfd = -1;
+
+    pipeinst->pipemsgcb = server->pipemsgcb;
+    pipeinst->msgbufcb = server->msgbufcb;
+    pipeinst->viewcb = server->viewcb;
+    pipeinst->pipemsgscb = server->pipemsgscb;
+    pipeinst->notifycb = server->notifycb;
+    pipeinst->argument = server->argument;
+    pipeinst->batchsize = server->batchsize;
+    pipeinst->pipeline = server->pipeline;
+    pipeinst->busypoll = server->busypoll;
+    pipeinst->spinstats = &server->spinstats;
+
+    pipeinst->notifyseq = 1;
+    pipeinst->cpu = -1;
+
+    pipeinst->timeout.tv_sec = server->client_timeout.tv_sec;
+    pipeinst->timeout.tv_usec = server->client_timeout.tv_usec;
+
+    if (server->client_timeout.tv_sec < 0) {
+        pipeinst->outq.waitusec = -1;
+    } else {
+        pipeinst->outq.waitusec = (int64_t) server->client_timeout.tv_sec * 1000000 + server->client_timeout.tv_usec;
+    }
+
+    return pipeinst;
+}
+
+
+static void pipe_instance_free (pipe_instance_t *pipeinst)
+{
+    if (__atomic_sub_fetch(&pipeinst->refc, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(pipeinst->requestfd);
+        close(pipeinst->replyfd);
+        if (pipeinst->outq.timerfd != -1) {
+            close(pipeinst->outq.timerfd);
+        }
+        pthread_mutex_destroy(&pipeinst->txlock);
+        mem_free(pipeinst->outq.buf);
+        shm_free(pipeinst->shm);
+        fifo_msgbuf_free(&pipeinst->bigrequest);
+        fifo_msgbuf_free(&pipeinst->bigreply);
+        if (pipeinst->rx) {
+            mem_pool_free(&rxbufpool, pipeinst->rx);
+        }
+        if (pipeinst->request) {
+            pipemsg_free(pipeinst->request);
+            pipemsg_free(pipeinst->reply);
+        }
+        mem_pool_free(&pipeinstpool, pipeinst);
+    }
+}
+
+
+/**
+ * pipe_instance_borrow()
+ *   get buffers from pools for pipe which has bytes to read.
+ */
+static void pipe_instance_borrow (pipe_instance_t *pipeinst)
+{
+    if (! pipeinst->rx) {
+        pipeinst->rx = (fifo_rxbuf_t *) mem_pool_alloc(&rxbufpool);
+        pipeinst->rx->head = pipeinst->rx->tail = 0;
+    }
+
+    if (! pipeinst->request) {
+        pipeinst->request = pipemsg_new();
+        pipeinst->reply = pipemsg_new();
+    }
+}
+
+
+/**
+ * pipe_instance_request()
+ *   get request buffer to decode next msg into. a buffer retained by
+ *   handler or queued to workpool is left to other holders.
+ */
+static fifo_pipemsg_t * pipe_instance_request (pipe_instance_t *pipeinst)
+{
+    if (mem_buf_shared(mem_buf_of(pipeinst->request))) {
+        pipemsg_free(pipeinst->request);
+        pipeinst->request = pipemsg_new();
+    }
+
+    return pipeinst->request;
+}
+
+
+/**
+ * pipe_instance_release()
+ *   give back buffers of pipe which goes idle, but rxbuf having a
+ *   partial msg and buffers of large msg being assembled.
+ */
+static void pipe_instance_release (pipe_instance_t *pipeinst)
+{
+    if (pipeinst->rx && pipeinst->rx->head == pipeinst->rx->tail) {
+        mem_pool_free(&rxbufpool, pipeinst->rx);
+        pipeinst->rx = NULL;
+    }
+
+    if (pipeinst->request) {
+        pipemsg_free(pipeinst->request);
+        pipemsg_free(pipeinst->reply);
+        pipeinst->request = NULL;
+        pipeinst->reply = NULL;
+    }
+
+    if (pipeinst->bigrequest.msgsz == 0) {
+        fifo_msgbuf_free(&pipeinst->bigrequest);
+        fifo_msgbuf_free(&pipeinst->bigreply);
+    }
+}
+
+
+#define pipe_instance_shmtx(pipeinst)  ((pipeinst)->shm? &(pipeinst)->shm->tx : NULL)
+
+
+/**
+ * pipe_instance_read()
+ *   read client msgs from shared memory ring or request pipe.
+ */
+static int pipe_instance_read (pipe_instance_t *pipeinst, int *more)
+{
+    pipe_instance_borrow(pipeinst);
+
+    if (pipeinst->shm) {
+        return rxbuf_read_shm(pipeinst->rx, &pipeinst->shm->rx, more);
+    }
+
+    return rxbuf_read(pipeinst->rx, pipeinst->requestfd, more);
+}
+
+
+/**
+ * fifo_reply_t
+ *   reply to a request viewed in place. reply frame goes straight into
+ *   txbuf after frames from txstart to txlen, which are written out
+ *   first if txbuf is full.
+ */
+struct fifo_reply_t
+{
+    pipe_instance_t *pipeinst;
+    const fifo_frame_t *frame;
+
+    char *txbuf;
+    int txcap;
+    int txstart;
+    int *txlen;
+
+    // body room reserved by fifo_reply_buffer
+    int bufsz;
+
+    // 1: replied, 2: deferred, -1: write error
+    int state;
+};
+
+
+static int reply_flush (fifo_reply_t *reply)
+{
+    int rc;
+    struct iovec iov;
+    pipe_instance_t *pipeinst = reply->pipeinst;
+
+    if (*reply->txlen == reply->txstart) {
+        return 0;
+    }
+
+    iov.iov_base = reply->txbuf + reply->txstart;
+    iov.iov_len = (size_t) (*reply->txlen - reply->txstart);
+
+    *reply->txlen = reply->txstart;
+
+    pthread_mutex_lock(&pipeinst->txlock);
+    rc = wire_writev(pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq, &iov, 1);
+    pthread_mutex_unlock(&pipeinst->txlock);
+
+    return rc;
+}
+
+
+static int reply_hdrsz (const fifo_reply_t *reply)
+{
+    return (int) sizeof(int32_t) + ((reply->frame->flags & FIFO_FRAME_F_REQID)? (int) sizeof(uint32_t) : 0);
+}
+
+
+/**
+ * fifo_reply_buffer()
+ *   get room for reply body of bufsz bytes at most. returns NULL if
+ *   bufsz exceeds one frame, already replied or write error.
+ */
+char * fifo_reply_buffer (fifo_reply_t *reply, int bufsz)
+{
+    int hdrsz = reply_hdrsz(reply);
+
+    if (reply->state || bufsz < 0 || hdrsz + bufsz > PIPEMSG_SIZE_MAX) {
+        return NULL;
+    }
+
+    if (*reply->txlen + hdrsz + bufsz > reply->txcap) {
+        if (reply_flush(reply) != 0) {
+            reply->state = -1;
+            return NULL;
+        }
+
+        if (*reply->txlen + hdrsz + bufsz > reply->txcap) {
+            return NULL;
+        }
+    }
+
+    reply->bufsz = bufsz;
+
+    return reply->txbuf + *reply->txlen + hdrsz;
+}
+
+
+/**
+ * fifo_reply_commit()
+ *   complete reply of msgsz bytes written into fifo_reply_buffer().
+ *   zero msgsz means no reply.
+ */
+int fifo_reply_commit (fifo_reply_t *reply, int msgsz)
+{
+    if (reply->state || msgsz < 0 || msgsz > reply->bufsz) {
+        return FIFO_E_BADARG;
+    }
+
+    if (msgsz > 0) {
+        *reply->txlen += frame_header(reply->txbuf + *reply->txlen, reply->frame->flags, reply->frame->reqid, msgsz) + msgsz;
+        reply->state = 1;
+    }
+
+    return FIFO_S_OK;
+}
+
+
+/**
+ * fifo_reply_iov()
+ *   reply with body gathered from iov. replies packed so far are written
+ *   out first, then header and iov in one writev, or chunk frames if the
+ *   body exceeds one frame.
+ */
+int fifo_reply_iov (fifo_reply_t *reply, const struct iovec *iov, int iovcnt)
+{
+    int i;
+    size_t msgsz = 0;
+
+    if (reply->state || iovcnt < 0) {
+        return FIFO_E_BADARG;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        msgsz += iov[i].iov_len;
+    }
+
+    if (msgsz > FIFO_MSGBUF_MAX) {
+        printf("msg too large: %" PRIu64 " bytes.\n", (uint64_t) msgsz);
+        return FIFO_E_BADARG;
+    }
+
+    if (msgsz == 0) {
+        return FIFO_S_OK;
+    }
+
+    reply->state = -1;
+
+    if (reply_flush(reply) != 0) {
+        return FIFO_E_FAILED;
+    }
+
+    pthread_mutex_lock(&reply->pipeinst->txlock);
+    if (frame_writev_chunks(reply->pipeinst->replyfd, pipe_instance_shmtx(reply->pipeinst), &reply->pipeinst->outq, iov, msgsz, reply->frame) == 0) {
+        reply->state = 1;
+    }
+    pthread_mutex_unlock(&reply->pipeinst->txlock);
+
+    return (reply->state == 1? FIFO_S_OK : FIFO_E_FAILED);
+}
+
+
+/**
+ * request_ctx
+ *   request being handled by calling thread, which fifo_reply_defer()
+ *   takes. reply is of viewcb only.
+ */
+static __thread struct
+{
+    pipe_instance_t *pipeinst;
+    const fifo_frame_t *frame;
+    fifo_reply_t *reply;
+
+    int deferred;
+} request_ctx;
+
+
+static void request_begin (pipe_instance_t *pipeinst, const fifo_frame_t *frame, fifo_reply_t *reply)
+{
+    request_ctx.pipeinst = pipeinst;
+    request_ctx.frame = frame;
+    request_ctx.reply = reply;
+    request_ctx.deferred = 0;
+}
+
+
+// handler returned: 1 if it deferred reply
+static int request_end (void)
+{
+    request_ctx.pipeinst = NULL;
+    return request_ctx.deferred;
+}
+
+
+fifo_reply_token fifo_reply_defer (void)
+{
+    struct fifo_reply_token_t *token;
+    pipe_instance_t *pipeinst = request_ctx.pipeinst;
+
+    if (! pipeinst || request_ctx.deferred || (request_ctx.reply && request_ctx.reply->state)) {
+        return NULL;
+    }
+
+#ifdef FIFO_USE_IO_URING
+    // replies of io_uring reactor are written without txlock
+    if (pipeinst->reactor && pipeinst->reactor->ring) {
+        return NULL;
+    }
+#endif
+
+    token = (struct fifo_reply_token_t *) mem_pool_alloc(&tokenpool);
+
+    __atomic_add_fetch(&pipeinst->refc, 1, __ATOMIC_RELAXED);
+    token->pipeinst = pipeinst;
+
+    token->frame.flags = request_ctx.frame->flags & FIFO_FRAME_F_REQID;
+    token->frame.reqid = request_ctx.frame->reqid;
+
+    if (request_ctx.reply) {
+        // no more reply by fifo_reply_t
+        request_ctx.reply->state = 2;
+    }
+
+    request_ctx.deferred = 1;
+    return token;
+}
+
+
+/**
+ * fifo_reply_send()
+ *   complete deferred reply from any thread. reply of any size goes out
+ *   under txlock of the pipe, in chunks if it exceeds one frame.
+ */
+int fifo_reply_send (fifo_reply_token token, const char *msg, size_t msgsz)
+{
+    int rc = 0;
+    pipe_instance_t *pipeinst = token->pipeinst;
+
+    if (msgsz > FIFO_MSGBUF_MAX) {
+        printf("msg too large: %" PRIu64 " bytes.\n", (uint64_t) msgsz);
+        return FIFO_E_BADARG;
+    }
+
+    if (msgsz > 0) {
+        pthread_mutex_lock(&pipeinst->txlock);
+        rc = frame_write_chunks(pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq, msg, msgsz, &token->frame);
+        pthread_mutex_unlock(&pipeinst->txlock);
+    }
+
+    pipe_instance_free(pipeinst);
+    mem_pool_free(&tokenpool, token);
+
+    return (rc == 0? FIFO_S_OK : FIFO_E_FAILED);
+}
+
+
+// request in one frame goes to workers if given: all of them in pipeline
+#define pipe_instance_offload(pipeinst, frame, workpool)  \
+    ((workpool) && (((frame)->flags & FIFO_FRAME_F_REQID) || (pipeinst)->pipeline))
+
+
+/**
+ * pipe_instance_viewable()
+ *   request in one frame is viewed in place unless it goes to workers.
+ */
+static int pipe_instance_viewable (pipe_instance_t *pipeinst, const fifo_frame_t *frame, fifo_workpool_t *workpool)
+{
+    if (! pipeinst->viewcb || (frame->flags & FIFO_FRAME_F_MORE) || pipeinst->bigrequest.msgsz > 0) {
+        return 0;
+    }
+
+    return ! pipe_instance_offload(pipeinst, frame, workpool);
+}
+
+
+/**
+ * pipe_instance_onview()
+ *   call viewcb for request msg. reply is packed into txbuf after frames
+ *   from txstart to txlen.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int pipe_instance_onview (pipe_instance_t *pipeinst, const char *msg, int msgsz, const fifo_frame_t *frame,
+    char *txbuf, int txcap, int txstart, int *txlen)
+{
+    fifo_reply_t reply;
+
+    reply.pipeinst = pipeinst;
+    reply.frame = frame;
+    reply.txbuf = txbuf;
+    reply.txcap = txcap;
+    reply.txstart = txstart;
+    reply.txlen = txlen;
+    reply.bufsz = 0;
+    reply.state = 0;
+
+    request_begin(pipeinst, frame, &reply);
+    pipeinst->viewcb(msg, msgsz, &reply, pipeinst->argument);
+    request_end();
+
+    request_arena_reset();
+
+    return (reply.state == -1? -1 : 0);
+}
+
+
+/**
+ * reactor_done()
+ *   pipeline: hand request done by worker back to reactor of its pipe.
+ *   reactor is woken up only if completion queue was empty.
+ */
+static void reactor_done (fifo_reactor_t *reactor, fifo_task_t *task)
+{
+    fifo_task_t *head = __atomic_load_n(&reactor->donelist, __ATOMIC_RELAXED);
+
+    do {
+        task->next = head;
+    } while (! __atomic_compare_exchange_n(&reactor->donelist, &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (! head) {
+        uint64_t one = 1;
+
+        if (write(reactor->donefd, &one, sizeof(one)) != sizeof(one)) {
+            printf("write eventfd failed: %s.\n", strerror(errno));
+        }
+    }
+}
+
+
+static void pipe_request_run (fifo_task_t *task)
+{
+    pipe_request_t *req = (pipe_request_t *) task;
+    pipe_instance_t *pipeinst = req->pipeinst;
+
+    if (req->frame.flags & FIFO_FRAME_F_ONEWAY) {
+        pipeinst->notifycb(req->request->msgbuf, req->request->msgsz, pipeinst->argument);
+
+        pipemsg_free(req->request);
+        request_arena_reset();
+
+        pipe_instance_free(pipeinst);
+        mem_pool_free(&requestpool, req);
+        return;
+    }
+
+    if (pipeinst->viewcb && pipeinst->pipeline) {
+        // reply frame fits in reply buffer
+        req->txlen = 0;
+
+        pipe_instance_onview(pipeinst, req->request->msgbuf, req->request->msgsz, &req->frame, (char *) req->reply, (int) sizeof(fifo_pipemsg_t), 0, &req->txlen);
+
+        pipemsg_free(req->request);
+
+        reactor_done(pipeinst->reactor, &req->task);
+        return;
+    }
+
+    if (pipeinst->viewcb) {
+        fifo_txbuf_t tx;
+
+        tx.len = 0;
+
+        pipe_instance_onview(pipeinst, req->request->msgbuf, req->request->msgsz, &req->frame, tx.buf, (int) sizeof(tx.buf), 0, &tx.len);
+
+        pthread_mutex_lock(&pipeinst->txlock);
+        txbuf_flush(&tx, pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq);
+        pthread_mutex_unlock(&pipeinst->txlock);
+
+        pipemsg_free(req->request);
+
+        pipe_instance_free(pipeinst);
+        mem_pool_free(&requestpool, req);
+        return;
+    }
+
+    req->reply->msgsz = 0;
+
+    request_begin(pipeinst, &req->frame, NULL);
+    pipeinst->pipemsgcb(req->request, req->reply, pipeinst->argument);
+
+    if (request_end()) {
+        req->reply->msgsz = 0;
+    }
+
+    if (pipeinst->pipeline) {
+        pipemsg_free(req->request);
+        request_arena_reset();
+
+        reactor_done(pipeinst->reactor, &req->task);
+        return;
+    }
+
+    if (req->reply->msgsz > 0) {
+        pthread_mutex_lock(&pipeinst->txlock);
+        frame_write(pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq, req->reply, &req->frame);
+        pthread_mutex_unlock(&pipeinst->txlock);
+    }
+
+    pipemsg_free(req->request);
+    pipemsg_free(req->reply);
+
+    request_arena_reset();
+
+    pipe_instance_free(pipeinst);
+    mem_pool_free(&requestpool, req);
+}
+
+
+/**
+ * pipe_request_new()
+ *   request of pipe to run by pipe_request_run() in worker. reference of
+ *   pipe is held until request is done.
+ */
+static pipe_request_t * pipe_request_new (pipe_instance_t *pipeinst, const fifo_frame_t *frame)
+{
+    pipe_request_t *req = (pipe_request_t *) mem_pool_alloc(&requestpool);
+
+    req->task.taskfn = pipe_request_run;
+    req->frame = *frame;
+
+    req->request = NULL;
+    req->reply = NULL;
+    req->txlen = 0;
+
+    req->bigrequest.msgbuf = NULL;
+    req->bigrequest.bufsz = 0;
+    req->bigrequest.msgsz = 0;
+    req->batch = NULL;
+
+    __atomic_add_fetch(&pipeinst->refc, 1, __ATOMIC_RELAXED);
+    req->pipeinst = pipeinst;
+
+    return req;
+}
+
+
+static int pipe_instance_flush (pipe_instance_t *pipeinst, fifo_txbuf_t *tx)
+{
+    int rc;
+
+    if (tx->len == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pipeinst->txlock);
+    rc = txbuf_flush(tx, pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq);
+    pthread_mutex_unlock(&pipeinst->txlock);
+
+    return rc;
+}
+
+
+static int pipe_instance_pack (pipe_instance_t *pipeinst, fifo_txbuf_t *tx, fifo_pipemsg_t *msg, const fifo_frame_t *frame)
+{
+    if (txbuf_pack(tx, msg, frame) == 0) {
+        return 0;
+    }
+
+    if (pipe_instance_flush(pipeinst, tx) != 0) {
+        return (-1);
+    }
+
+    return txbuf_pack(tx, msg, frame);
+}
+
+
+// request in one frame goes to batch handler
+#define pipe_instance_batchable(pipeinst, frame)  \
+    ((pipeinst)->pipemsgscb && ! ((frame)->flags & (FIFO_FRAME_F_MORE|FIFO_FRAME_F_ONEWAY)) && (pipeinst)->bigrequest.msgsz == 0)
+
+
+/**
+ * pipe_instance_onnotify()
+ *   count one-way msg for next ack and lost ones by gap in sequence
+ *   numbers, then call notifycb for it, or queue it to workers if given.
+ */
+static void pipe_instance_onnotify (pipe_instance_t *pipeinst, const char *msg, int msgsz, const fifo_frame_t *frame, fifo_workpool_t *workpool)
+{
+    int32_t gap = (int32_t) (frame->reqid - pipeinst->notifyseq);
+
+    if (gap > 0) {
+        printf("one-way msgs lost: %d\n", gap);
+        pipeinst->notifylost += (uint32_t) gap;
+    }
+
+    pipeinst->notifyseq = frame->reqid + 1;
+    pipeinst->unacked++;
+
+    if (! pipeinst->notifycb) {
+        return;
+    }
+
+    if (workpool) {
+        pipe_request_t *req = pipe_request_new(pipeinst, frame);
+
+        req->request = pipemsg_new();
+        req->request->msgsz = msgsz;
+        memcpy(req->request->msgbuf, msg, msgsz);
+
+        workpool_push(workpool, &req->task);
+        return;
+    }
+
+    pipeinst->notifycb(msg, msgsz, pipeinst->argument);
+
+    request_arena_reset();
+}
+
+
+/**
+ * pipe_instance_ack()
+ *   build cumulative ack of one-way msgs received since last ack into
+ *   buf of FIFO_ACK_SIZE bytes.
+ *
+ * returns:
+ *   size of ack frame, 0 if nothing to ack.
+ */
+static int pipe_instance_ack (pipe_instance_t *pipeinst, char *buf)
+{
+    int hdrsz;
+
+    if (! pipeinst->unacked) {
+        return 0;
+    }
+
+    pipeinst->unacked = 0;
+
+    hdrsz = frame_header(buf, FIFO_FRAME_F_ACK|FIFO_FRAME_F_REQID, pipeinst->notifyseq - 1, (int) sizeof(uint32_t));
+    memcpy(buf + hdrsz, &pipeinst->notifylost, sizeof(uint32_t));
+
+    return hdrsz + (int) sizeof(uint32_t);
+}
+
+
+/**
+ * pipe_batch_add()
+ *   copy request into batch, which is created on first request.
+ */
+static pipe_batch_t * pipe_batch_add (pipe_batch_t *batch, pipe_instance_t *pipeinst, const char *msg, int msgsz, const fifo_frame_t *frame)
+{
+    fifo_pipemsg_t *request = pipemsg_new();
+
+    if (! batch) {
+        batch = (pipe_batch_t *) mem_pool_alloc(&batchpool);
+
+        batch->pipeinst = pipeinst;
+        batch->n = 0;
+        batch->reqids = 1;
+    }
+
+    request->msgsz = msgsz;
+    memcpy(request->msgbuf, msg, msgsz);
+
+    batch->frames[batch->n] = *frame;
+    batch->requests[batch->n] = request;
+    batch->n++;
+
+    if (! (frame->flags & FIFO_FRAME_F_REQID)) {
+        batch->reqids = 0;
+    }
+
+    return batch;
+}
+
+
+/**
+ * pipe_batch_call()
+ *   call pipemsgscb for all of requests in batch. replies are left in
+ *   batch for caller to pack.
+ */
+static void pipe_batch_call (pipe_batch_t *batch)
+{
+    int i;
+    pipe_instance_t *pipeinst = batch->pipeinst;
+
+    for (i = 0; i < batch->n; i++) {
+        batch->replies[i] = pipemsg_new();
+        batch->replies[i]->msgsz = 0;
+    }
+
+    pipeinst->pipemsgscb((const fifo_pipemsg_t **) batch->requests, batch->replies, batch->n, pipeinst->argument);
+}
+
+
+static void pipe_batch_free (pipe_batch_t *batch)
+{
+    int i;
+
+    for (i = 0; i < batch->n; i++) {
+        pipemsg_free(batch->requests[i]);
+        pipemsg_free(batch->replies[i]);
+    }
+
+    request_arena_reset();
+
+    mem_pool_free(&batchpool, batch);
+}
+
+
+/**
+ * pipe_batch_pack()
+ *   call batch handler and pack replies into tx in order of requests.
+ *   batch is freed.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int pipe_batch_pack (pipe_batch_t *batch, fifo_txbuf_t *tx)
+{
+    int i, rc = 0;
+
+    pipe_batch_call(batch);
+
+    for (i = 0; i < batch->n && rc == 0; i++) {
+        if (batch->replies[i]->msgsz > 0) {
+            rc = pipe_instance_pack(batch->pipeinst, tx, batch->replies[i], &batch->frames[i]);
+        }
+    }
+
+    pipe_batch_free(batch);
+    return rc;
+}
+
+
+static void pipe_batch_run (fifo_task_t *task)
+{
+    fifo_txbuf_t tx;
+
+    pipe_batch_t *batch = (pipe_batch_t *) task;
+    pipe_instance_t *pipeinst = batch->pipeinst;
+
+    tx.len = 0;
+
+    pipe_batch_pack(batch, &tx);
+    pipe_instance_flush(pipeinst, &tx);
+
+    pipe_instance_free(pipeinst);
+}
+
+
+/**
+ * pipe_instance_onmsgbuf()
+ *   call msgbufcb for request into reply. reply fits in one frame is
+ *   packed into tx through packmsg, larger one is written out at once in
+ *   chunks after tx.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int pipe_instance_onmsgbuf (pipe_instance_t *pipeinst, const fifo_msgbuf_t *request, const fifo_frame_t *frame,
+    fifo_msgbuf_t *reply, fifo_pipemsg_t *packmsg, fifo_txbuf_t *tx)
+{
+    int rc;
+
+    reply->msgsz = 0;
+
+    request_begin(pipeinst, frame, NULL);
+    pipeinst->msgbufcb(request, reply, pipeinst->argument);
+
+    if (request_end()) {
+        reply->msgsz = 0;
+    } else if (reply->msgsz > reply->bufsz) {
+        printf("bad size for reply: msgsz=%" PRIu64 "\n", (uint64_t) reply->msgsz);
+        reply->msgsz = reply->bufsz;
+    }
+
+    if (reply->msgsz == 0) {
+        rc = 0;
+    } else if (reply->msgsz <= PIPEMSG_REQID_BODY_MAX) {
+        packmsg->msgsz = (int) reply->msgsz;
+        memcpy(packmsg->msgbuf, reply->msgbuf, reply->msgsz);
+
+        rc = pipe_instance_pack(pipeinst, tx, packmsg, frame);
+    } else {
+        pthread_mutex_lock(&pipeinst->txlock);
+        rc = txbuf_flush(tx, pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq);
+        if (rc == 0) {
+            rc = frame_write_chunks(pipeinst->replyfd, pipe_instance_shmtx(pipeinst), &pipeinst->outq, reply->msgbuf, reply->msgsz, frame);
+        }
+        pthread_mutex_unlock(&pipeinst->txlock);
+    }
+
+    msgbuf_reset(reply);
+    request_arena_reset();
+
+    return rc;
+}
+
+
+/**
+ * pipe_instance_submit()
+ *   queue request to workers. pipeline: requests without id run one at
+ *   a time in order, the rest wait in pipe until reactor_ondone().
+ */
+static void pipe_instance_submit (pipe_instance_t *pipeinst, pipe_request_t *req, fifo_workpool_t *workpool)
+{
+    if (! (req->frame.flags & FIFO_FRAME_F_REQID)) {
+        // pipeline: replies without id must go in order
+        if (pipeinst->serialbusy) {
+            req->task.next = NULL;
+
+            if (pipeinst->serialtail) {
+                pipeinst->serialtail->next = &req->task;
+            } else {
+                pipeinst->serialhead = &req->task;
+            }
+            pipeinst->serialtail = &req->task;
+            return;
+        }
+
+        pipeinst->serialbusy = 1;
+    }
+
+    workpool_push(workpool, &req->task);
+}
+
+
+/**
+ * pipe_request_pack()
+ *   pipeline: run large msg, request for msgbufcb or batch in worker.
+ *   replies are written by worker itself, which keeps them in order as
+ *   requests without id run one at a time. request goes back to reactor
+ *   with empty reply only to let next one of pipe run.
+ */
+static void pipe_request_pack (fifo_task_t *task)
+{
+    fifo_txbuf_t tx;
+    fifo_msgbuf_t reply;
+
+    pipe_request_t *req = (pipe_request_t *) task;
+    pipe_instance_t *pipeinst = req->pipeinst;
+
+    tx.len = 0;
+
+    reply.msgbuf = NULL;
+    reply.bufsz = 0;
+    reply.msgsz = 0;
+
+    if (req->batch) {
+        pipe_batch_pack(req->batch, &tx);
+    } else {
+        fifo_msgbuf_t request = req->bigrequest;
+
+        if (req->request) {
+            request.msgsz = (size_t) req->request->msgsz;
+            request.bufsz = sizeof(req->request->msgbuf);
+            request.msgbuf = req->request->msgbuf;
+        }
+
+        if (pipeinst->msgbufcb) {
+            pipe_instance_onmsgbuf(pipeinst, &request, &req->frame, &reply, req->reply, &tx);
+        } else if (pipeinst->viewcb) {
+            pipe_instance_onview(pipeinst, request.msgbuf, (int) request.msgsz, &req->frame, tx.buf, (int) sizeof(tx.buf), 0, &tx.len);
+        } else {
+            printf("large msg dropped: no msgbufcb.\n");
+        }
+    }
+
+    pipe_instance_flush(pipeinst, &tx);
+
+    if (req->request) {
+        pipemsg_free(req->request);
+    }
+    fifo_msgbuf_free(&req->bigrequest);
+    fifo_msgbuf_free(&reply);
+
+    req->reply->msgsz = 0;
+    req->txlen = 0;
+
+    reactor_done(pipeinst->reactor, &req->task);
+}
+
+
+/**
+ * pipe_instance_onbatch()
+ *   hand over batch to workers if all of requests have id, or in order
+ *   with requests without id in pipeline. otherwise run it and pack
+ *   replies into tx.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int pipe_instance_onbatch (pipe_instance_t *pipeinst, pipe_batch_t *batch, fifo_workpool_t *workpool, fifo_txbuf_t *tx)
+{
+    if (! batch) {
+        return 0;
+    }
+
+    if (workpool && batch->reqids) {
+        batch->task.taskfn = pipe_batch_run;
+
+        __atomic_add_fetch(&pipeinst->refc, 1, __ATOMIC_RELAXED);
+
+        workpool_push(workpool, &batch->task);
+        return 0;
+    }
+
+    if (workpool && pipeinst->pipeline) {
+        fifo_frame_t frame;
+        pipe_request_t *req;
+
+        frame.flags = 0;
+        frame.reqid = 0;
+
+        req = pipe_request_new(pipeinst, &frame);
+        req->task.taskfn = pipe_request_pack;
+        req->reply = pipemsg_new();
+        req->batch = batch;
+
+        pipe_instance_submit(pipeinst, req, workpool);
+        return 0;
+    }
+
+    return pipe_batch_pack(batch, tx);
+}
+
+
+/**
+ * pipe_instance_onchunk()
+ *   add chunk in request to large msg being assembled. the last chunk
+ *   completes msg which is passed to msgbufcb, by worker in pipeline.
+ *
+ * returns:
+ *    0: success
+ *   -1: msg too large or write error
+ */
+static int pipe_instance_onchunk (pipe_instance_t *pipeinst, const fifo_frame_t *frame, fifo_workpool_t *workpool, fifo_txbuf_t *tx)
+{
+    int rc = 0;
+    fifo_msgbuf_t *request = &pipeinst->bigrequest;
+
+    if (msgbuf_append(request, pipeinst->request->msgbuf, pipeinst->request->msgsz) != 0) {
+        return (-1);
+    }
+
+    if (frame->flags & FIFO_FRAME_F_MORE) {
+        return 0;
+    }
+
+    if (workpool && pipeinst->pipeline) {
+        pipe_request_t *req = pipe_request_new(pipeinst, frame);
+
+        req->task.taskfn = pipe_request_pack;
+        req->reply = pipemsg_new();
+
+        // msg goes with request, pipe assembles next one anew
+        req->bigrequest = *request;
+        request->msgbuf = NULL;
+        request->bufsz = 0;
+        request->msgsz = 0;
+
+        pipe_instance_submit(pipeinst, req, workpool);
+        return 0;
+    }
+
+    if (pipeinst->msgbufcb) {
+        rc = pipe_instance_onmsgbuf(pipeinst, request, frame, &pipeinst->bigreply, pipeinst->reply, tx);
+    } else if (pipeinst->viewcb) {
+        rc = pipe_instance_onview(pipeinst, request->msgbuf, (int) request->msgsz, frame, tx->buf, (int) sizeof(tx->buf), 0, &tx->len);
+    } else {
+        printf("large msg dropped: no msgbufcb.\n");
+    }
+
+    msgbuf_reset(request);
+    return rc;
+}
+
+
+/**
+ * pipe_instance_onmsg()
+ *   call pipemsgcb for the request and pack reply into tx.
+ *   a request with id is queued to workpool if given, every request
+ *   in pipeline.
+ *
+ * returns:
+ *    0: success
+ *   -1: write error
+ */
+static int pipe_instance_onmsg (pipe_instance_t *pipeinst, const fifo_frame_t *frame, fifo_workpool_t *workpool, fifo_txbuf_t *tx)
+{
+    if ((frame->flags & FIFO_FRAME_F_MORE) || pipeinst->bigrequest.msgsz > 0) {
+        return pipe_instance_onchunk(pipeinst, frame, workpool, tx);
+    }
+
+    if (! pipeinst->pipemsgcb && ! pipeinst->viewcb) {
+        fifo_msgbuf_t request;
+
+        if (workpool && pipeinst->pipeline) {
+            pipe_request_t *req = pipe_request_new(pipeinst, frame);
+
+            req->task.taskfn = pipe_request_pack;
+            req->request = (fifo_pipemsg_t *) fifo_pipemsg_retain(pipeinst->request);
+            req->reply = pipemsg_new();
+
+            pipe_instance_submit(pipeinst, req, workpool);
+            return 0;
+        }
+
+        request.msgsz = (size_t) pipeinst->request->msgsz;
+        request.bufsz = sizeof(pipeinst->request->msgbuf);
+        request.msgbuf = pipeinst->request->msgbuf;
+
+        return pipe_instance_onmsgbuf(pipeinst, &request, frame, &pipeinst->bigreply, pipeinst->reply, tx);
+    }
+
+    if (pipe_instance_offload(pipeinst, frame, workpool)) {
+        pipe_request_t *req = pipe_request_new(pipeinst, frame);
+
+        req->request = (fifo_pipemsg_t *) fifo_pipemsg_retain(pipeinst->request);
+        req->reply = (pipeinst->viewcb && ! pipeinst->pipeline? NULL : pipemsg_new());
+
+        pipe_instance_submit(pipeinst, req, workpool);
+        return 0;
+    }
+
+    if (pipeinst->viewcb) {
+        return pipe_instance_onview(pipeinst, pipeinst->request->msgbuf, pipeinst->request->msgsz, frame, tx->buf, (int) sizeof(tx->buf), 0, &tx->len);
+    }
+
+    pipeinst->reply->msgsz = 0;
+
+    request_begin(pipeinst, frame, NULL);
+    pipeinst->pipemsgcb(pipeinst->request, pipeinst->reply, pipeinst->argument);
+
+    if (request_end()) {
+        pipeinst->reply->msgsz = 0;
+    }
+
+    if (pipeinst->reply->msgsz > 0 && pipe_instance_pack(pipeinst, tx, pipeinst->reply, frame) != 0) {
+        return (-1);
+    }
+
+    request_arena_reset();
+    return 0;
+}
+
+
+/**
+ * pipe_instance_ondata()
+ *   handle all of complete msgs in rxbuf. partial msg is kept. replies
+ *   to msgs of one read go out in as few writes as possible.
+ *
+ * returns:
+ *    0: success
+ *   -1: client closed or pipe error
+ */
+static int pipe_instance_ondata (pipe_instance_t *pipeinst)
+{
+    int rc, bodysz;
+    const char *body;
+    fifo_frame_t frame;
+    fifo_txbuf_t tx;
+
+    pipe_batch_t *batch = NULL;
+    fifo_workpool_t *workpool = (pipeinst->reactor? pipeinst->reactor->server->workpool : NULL);
+
+    tx.len = 0;
+
+    while ((rc = rxbuf_next(pipeinst->rx, &body, &bodysz, &frame)) == 1) {
+        fifo_pipemsg_t *request;
+
+        if (bodysz == 0 && ! frame.flags) {
+            printf("client closed.\n");
+            pipe_instance_onbatch(pipeinst, batch, workpool, &tx);
+            pipe_instance_flush(pipeinst, &tx);
+            return (-1);
+        }
+
+        if (pipe_instance_batchable(pipeinst, &frame)) {
+            batch = pipe_batch_add(batch, pipeinst, body, bodysz, &frame);
+
+            if (batch->n == pipeinst->batchsize) {
+                rc = pipe_instance_onbatch(pipeinst, batch, workpool, &tx);
+                batch = NULL;
+
+                if (rc != 0) {
+                    return (-1);
+                }
+            }
+            continue;
+        }
+
+        // requests in batch are answered first
+        rc = pipe_instance_onbatch(pipeinst, batch, workpool, &tx);
+        batch = NULL;
+
+        if (rc != 0) {
+            return (-1);
+        }
+
+        if (frame.flags & FIFO_FRAME_F_ONEWAY) {
+            pipe_instance_onnotify(pipeinst, body, bodysz, &frame, workpool);
+            continue;
+        }
+
+        if (pipe_instance_viewable(pipeinst, &frame, workpool)) {
+            if (pipe_instance_onview(pipeinst, body, bodysz, &frame, tx.buf, (int) sizeof(tx.buf), 0, &tx.len) != 0) {
+                return (-1);
+            }
+            continue;
+        }
+
+        request = pipe_instance_request(pipeinst);
+        request->msgsz = bodysz;
+        memcpy(request->msgbuf, body, bodysz);
+
+        if (pipe_instance_onmsg(pipeinst, &frame, workpool, &tx) != 0) {
+            return (-1);
+        }
+    }
+
+    if (pipe_instance_onbatch(pipeinst, batch, workpool, &tx) != 0) {
+        return (-1);
+    }
+
+    if (pipeinst->unacked) {
+        if (tx.len + FIFO_ACK_SIZE > (int) sizeof(tx.buf) && pipe_instance_flush(pipeinst, &tx) != 0) {
+            return (-1);
+        }
+
+        tx.len += pipe_instance_ack(pipeinst, tx.buf + tx.len);
+    }
+
+    if (pipe_instance_flush(pipeinst, &tx) != 0) {
+        return (-1);
+    }
+
+    return rc;
+}
+
+
+// pollfn of busy-poll: read request pipe
+static int pipe_instance_spin (void *arg)
+{
+    int more;
+
+    return pipe_instance_read((pipe_instance_t *) arg, &more);
+}
+
+
+static void * client_fifo_worker (void *arg)
+{
+    int rc, more, got = 0;
+    fd_set rfds;
+    fifo_spin_t spin;
+
+    pipe_instance_t *pipeinst = (pipe_instance_t *) arg;
+
+    // shared memory rings spin by themselves
+    int busypoll = (pipeinst->busypoll && ! pipeinst->shm);
+
+    if (busypoll) {
+        spin_init(&spin, pipeinst->busypoll, pipeinst->spinstats);
+    }
+
+    printf("client_fifo_worker(accept_pipefd=%d) start...\n", pipeinst->requestfd);
+
+    while(1) {
+        if (pipeinst->shm && ! shmring_sleep(&pipeinst->shm->rx)) {
+            // msgs in ring: no wait
+            rc = 1;
+        } else if (busypoll && (got = spin_poll(&spin, pipe_instance_spin, pipeinst)) != 0) {
+            // read (or failed) while spinning
+            rc = 1;
+        } else {
+            pipe_instance_release(pipeinst);
+
+            FD_ZERO(&rfds);
+            FD_SET(pipeinst->requestfd, &rfds);
+
+            if (pipeinst->timeout.tv_sec < 0) {
+                rc = select(pipeinst->requestfd + 1, &rfds, NULL, NULL, NULL);
+            } else {
+                rc = select(pipeinst->requestfd + 1, &rfds, NULL, NULL, &pipeinst->timeout);
+            }
+
+            if (rc == 1 && pipeinst->shm) {
+                shm_drain_doorbell(pipeinst->requestfd);
+            }
+
+            if (busypoll) {
+                spin_waited(&spin);
+            }
+        }
+
+        if (rc == 1) {
+            rc = (got? got : pipe_instance_read(pipeinst, &more));
+            got = 0;
+
+            if (rc > 0) {
+                if (pipe_instance_ondata(pipeinst) == 0) {
+                    continue;
+                }
+
+                break;
+            }
+
+            if (rc == 0) {
+                // nothing to read
+                continue;
+            }
+
+            // read pipe error
+            break;
+        } else if (rc == 0) {
+            // timeout with no ready
+            printf("*");
+        } else {
+            printf("select failed: %s.\n", strerror(errno));
+            break;
+        }
+    }
+
+    printf("client_fifo_worker(accept_pipefd=%d) exit.\n", pipeinst->requestfd);
+
+    pipe_instance_free(pipeinst);
+    request_arena_free();
+    return NULL;
+}
+
+
+/**
+ * server_attach_shm()
+ *   map shared memory rings offered in client connect msg after name of
+ *   client pipe: ".12345\0/fifo.12345.0\0".
+ *
+ * returns:
+ *   header of rings or NULL if none offered or failed.
+ */
+static fifo_shmhdr_t * server_attach_shm (const fifo_pipemsg_t *clientmsg, size_t *mapsz)
+{
+    int shmfd;
+    struct stat st;
+    fifo_shmhdr_t *hdr;
+
+    const char *end = clientmsg->msgbuf + clientmsg->msgsz;
+    const char *shmname = (const char *) memchr(clientmsg->msgbuf, 0, clientmsg->msgsz);
+
+    if (! shmname || ++shmname >= end || *shmname != '/' || ! memchr(shmname, 0, end - shmname)) {
+        return NULL;
+    }
+
+    shmfd = shm_open(shmname, O_RDWR, 0);
+    if (shmfd == -1) {
+        printf("shm_open failed: %s - %s.\n", strerror(errno), shmname);
+        return NULL;
+    }
+
+    if (fstat(shmfd, &st) == -1 || st.st_size < (off_t) sizeof(*hdr)) {
+        printf("bad shared memory: %s.\n", shmname);
+        close(shmfd);
+        return NULL;
+    }
+
+    hdr = (fifo_shmhdr_t *) mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
+    close(shmfd);
+
+    if (hdr == MAP_FAILED) {
+        printf("mmap failed: %s - %s.\n", strerror(errno), shmname);
+        return NULL;
+    }
+
+    if (hdr->magic != FIFO_SHM_MAGIC ||
+        hdr->ringsz < FIFO_SHM_RING_MIN || hdr->ringsz > FIFO_SHM_RING_MAX ||
+        (hdr->ringsz & (hdr->ringsz - 1)) || shm_mapsize(hdr->ringsz) != (size_t) st.st_size) {
+        printf("bad shared memory: %s.\n", shmname);
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+
+    *mapsz = (size_t) st.st_size;
+
+    // client sees it when its request pipe is opened
+    __atomic_store_n(&hdr->attached, 1, __ATOMIC_RELEASE);
+
+    return hdr;
+}
+
+
+/**
+ * server_client_cpu()
+ *   get cpu hint in client connect msg: ".12345\0[/fifo.12345.0\0]@3\0"
+ *
+ * returns:
+ *   cpu client ran on, or -1 if none.
+ */
+static int server_client_cpu (const fifo_pipemsg_t *clientmsg)
+{
+    const char *end = clientmsg->msgbuf + clientmsg->msgsz;
+    const char *field = (const char *) memchr(clientmsg->msgbuf, 0, clientmsg->msgsz);
+
+    while (field && ++field < end) {
+        if (*field == '@' && memchr(field, 0, end - field)) {
+            int cpu = atoi(field + 1);
+
+            return (cpu >= 0 && cpu < CPU_SETSIZE? cpu : -1);
+        }
+
+        field = (const char *) memchr(field, 0, end - field);
+    }
+
+    return (-1);
+}
+
+
+/**
+ * server_accept_sync()
+ *   check connect msgs in rx: "int32 msgsz | .12345...". bytes which do
+ *   not start one (rest of a msg whose head was taken by a process which
+ *   died, or garbage) are dropped up to next valid header. a partial msg
+ *   at end is kept only if read was cut by room of rx (cut is 1): a whole
+ *   msg is always in pipe once any byte of it is.
+ *
+ * returns:
+ *   bytes missing from last msg in rx, 0 if none.
+ */
+static int server_accept_sync (fifo_rxbuf_t *rx, int cut)
+{
+    int32_t msgsz = 0;
+    int at = rx->head, skip;
+    int hdrsz = (int) sizeof(msgsz);
+
+    while (at + hdrsz <= rx->tail) {
+        for (skip = at; skip + hdrsz <= rx->tail; skip++) {
+            memcpy(&msgsz, rx->buf + skip, hdrsz);
+
+            if (msgsz == 0 || (msgsz > 0 && msgsz <= PIPEMSG_SIZE_MAX - hdrsz &&
+                (skip + hdrsz == rx->tail || rx->buf[skip + hdrsz] == '.'))) {
+                break;
+            }
+        }
+
+        if (skip > at) {
+            printf("drop %d bytes on accept pipe.\n", skip - at);
+
+            memmove(rx->buf + at, rx->buf + skip, rx->tail - skip);
+            rx->tail -= skip - at;
+            continue;
+        }
+
+        if (at + hdrsz + msgsz > rx->tail) {
+            break;
+        }
+
+        at += hdrsz + msgsz;
+    }
+
+    if (at < rx->tail && ! cut) {
+        printf("drop %d bytes on accept pipe.\n", rx->tail - at);
+
+        rx->tail = at;
+    }
+
+    if (at == rx->tail) {
+        return 0;
+    }
+
+    if (at + hdrsz > rx->tail) {
+        return at + hdrsz - rx->tail;
+    }
+
+    return at + hdrsz + msgsz - rx->tail;
+}
+
+
+/**
+ * server_accept_read()
+ *   read connect msgs from accept pipe (or lane) into rx. pipe shared by
+ *   worker processes is read under accept lock in one read which takes
+ *   whole msgs only: a client writes its connect msg in one write (not
+ *   over PIPE_BUF), which is atomic. only if rx has no room for all of
+ *   pending msgs, rest of last one is read next. bytes left of a msg by
+ *   a process which died in between are skipped by server_accept_sync.
+ */
+static int server_accept_read (fifo_server server, fifo_rxbuf_t *rx, int fd, int *more)
+{
+    int count, cut, missing;
+    char *room;
+
+    if (! server->acceptlock) {
+        return rxbuf_read(rx, fd, more);
+    }
+
+    if (pthread_mutex_lock(server->acceptlock) == EOWNERDEAD) {
+        pthread_mutex_consistent(server->acceptlock);
+    }
+
+    count = rxbuf_read(rx, fd, more);
+    cut = *more;
+
+    while (count > 0 && (missing = server_accept_sync(rx, cut)) > 0) {
+        ssize_t cb;
+
+        // rest of last msg cut by room of rx
+        rxbuf_room(rx, &room);
+
+        cb = read(fd, room, missing);
+        if (cb <= 0) {
+            server_accept_sync(rx, 0);
+            break;
+        }
+
+        rx->tail += (int) cb;
+        cut = (cb < missing);
+    }
+
+    pthread_mutex_unlock(server->acceptlock);
+
+    return count;
+}
+
+
+/**
+ * server_accept_client()
+ *   open pipes for client connect msg: ".12345"
+ */
+static pipe_instance_t * server_accept_client (fifo_server server, const fifo_pipemsg_t *clientmsg)
+{
+    int requestfd, replyfd, client_fifolen;
+    char client_fifo[FIFO_NAMELEN_MAX + 1];
+
+    size_t shmsz = 0;
+    fifo_shmhdr_t *shmhdr;
+    pipe_instance_t *pipeinst;
+
+    client_fifolen = snprintf(client_fifo, FIFO_NAMELEN_MAX - 5, "%.*s%.*s",
+                        server->namelen, server->pipename, (int)clientmsg->msgsz, clientmsg->msgbuf);
+    if (client_fifolen < 0 || client_fifolen >= FIFO_NAMELEN_MAX - 5) {
+        printf("bad message from client: {%.*s}\n", (int)clientmsg->msgsz, clientmsg->msgbuf);
+        return NULL;
+    }
+
+    printf("message from client: {%.*s}\n", client_fifolen, client_fifo);
+
+    shmhdr = server_attach_shm(clientmsg, &shmsz);
+
+    requestfd = open(client_fifo, O_NONBLOCK|O_RDWR);
+    if (requestfd == -1) {
+        printf("open fifo failed: %s - %s.\n", strerror(errno), client_fifo);
+        if (shmhdr) {
+            munmap(shmhdr, shmsz);
+        }
+        return NULL;
+    }
+
+    printf("client connect on pipe: {%.*s}\n", client_fifolen, client_fifo);
+
+    memcpy(client_fifo + client_fifolen, "-read", 6);
+
+    // client opened it first. never block on a client which does not
+    //   read: replies it has no room for are queued by reactor
+    replyfd = open(client_fifo, O_WRONLY|O_NONBLOCK);
+    if (replyfd == -1) {
+        printf("open fifo failed: %s - %s.\n", strerror(errno), client_fifo);
+        close(requestfd);
+        if (shmhdr) {
+            munmap(shmhdr, shmsz);
+        }
+        return NULL;
+    }
+
+    pipeinst = pipe_instance_new(requestfd, replyfd, server);
+
+    if (shmhdr) {
+        pipeinst->shm = shm_new(shmhdr, shmsz, 0, requestfd, replyfd);
+
+        // replies go to ring, never blocked on a client which stops reading
+        pipeinst->outq.shm = &pipeinst->shm->tx;
+    }
+
+    if (server->colocate) {
+        int cpu = server_client_cpu(clientmsg);
+
+        // never pin to a cpu server may not run on
+        if (cpu != -1 && CPU_ISSET(cpu, &server->cpuallowed)) {
+            pipeinst->cpu = cpu;
+        }
+    }
+
+    return pipeinst;
+}
+
+
+#ifdef FIFO_HAVE_EPOLL
+
+static void reactor_onready (fifo_task_t *task);
+static void reactor_onwritable (fifo_task_t *task);
+
+
+static int reactor_add_pipe (fifo_reactor_t *reactor, pipe_instance_t *pipeinst)
+{
+    struct epoll_event ev;
+
+    // one shot: a pipe is never handled by 2 threads at the same time
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = pipeinst;
+
+    pipeinst->reactor = reactor;
+    pipeinst->task.taskfn = reactor_onready;
+
+    pipeinst->txtask.taskfn = reactor_onwritable;
+    pipeinst->outq.epollfd = reactor->epollfd;
+
+    return epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, pipeinst->requestfd, &ev);
+}
+
+
+static int reactor_arm_pipe (pipe_instance_t *pipeinst)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = pipeinst;
+
+    return epoll_ctl(pipeinst->reactor->epollfd, EPOLL_CTL_MOD, pipeinst->requestfd, &ev);
+}
+
+
+/**
+ * reactor_rearm_pipe()
+ *   get next requests of pipe, unless replies are queued for it: client
+ *   must read them first, then reactor_onwritable() rearms pipe.
+ */
+static int reactor_rearm_pipe (pipe_instance_t *pipeinst)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&pipeinst->txlock);
+
+    if (pipeinst->outq.len > 0) {
+        pipeinst->rxpaused = 1;
+    } else {
+        rc = reactor_arm_pipe(pipeinst);
+    }
+
+    pthread_mutex_unlock(&pipeinst->txlock);
+
+    return rc;
+}
+
+
+static void reactor_close_pipe (pipe_instance_t *pipeinst)
+{
+    epoll_ctl(pipeinst->reactor->epollfd, EPOLL_CTL_DEL, pipeinst->requestfd, NULL);
+
+    pipe_instance_free(pipeinst);
+}
+
+
+static int reactor_onread (pipe_instance_t *pipeinst);
+static void reactor_onready (fifo_task_t *task);
+
+
+/**
+ * reactor_onwritable()
+ *   reply pipe (or shm ring) may have room again: write replies queued
+ *   for it. a pipe paused meanwhile is rearmed once all of them are
+ *   written, or closed if client is gone. runs in reactor thread.
+ */
+static void reactor_onwritable (fifo_task_t *task)
+{
+    int rc, paused;
+    pipe_instance_t *pipeinst = (pipe_instance_t *) ((char *) task - offsetof(pipe_instance_t, txtask));
+
+    pthread_mutex_lock(&pipeinst->txlock);
+
+    pipeinst->outq.armed = 0;
+
+    rc = outq_flush(&pipeinst->outq);
+
+    if (rc == 1) {
+        if (outq_arm(&pipeinst->outq) == 0) {
+            // reference goes on with next event
+            pthread_mutex_unlock(&pipeinst->txlock);
+            return;
+        }
+
+        pipeinst->outq.failed = 1;
+        pipeinst->outq.len = 0;
+        rc = -1;
+    }
+
+    paused = pipeinst->rxpaused;
+    pipeinst->rxpaused = 0;
+
+    if (paused && rc == 0 && ! pipeinst->shm && reactor_arm_pipe(pipeinst) != 0) {
+        rc = -1;
+    }
+
+    pthread_mutex_unlock(&pipeinst->txlock);
+
+    if (paused && rc != 0) {
+        reactor_close_pipe(pipeinst);
+    } else if (paused && pipeinst->shm) {
+        // requests left in ring ring no doorbell: read them now
+        if (pipeinst->reactor->server->workpool && ! pipeinst->reactor->server->pipeline) {
+            workpool_push(pipeinst->reactor->server->workpool, &pipeinst->task);
+        } else {
+            reactor_onready(&pipeinst->task);
+        }
+    }
+
+    // drop reference of event
+    pipe_instance_free(pipeinst);
+}
+
+
+/**
+ * reactor_onready()
+ *   handle a ready pipe then rearm it. it runs in reactor thread
+ *   or in a worker thread of workpool.
+ */
+static void reactor_onready (fifo_task_t *task)
+{
+    pipe_instance_t *pipeinst = (pipe_instance_t *) task;
+
+    if (reactor_onread(pipeinst) == 0 && reactor_rearm_pipe(pipeinst) == 0) {
+        return;
+    }
+
+    reactor_close_pipe(pipeinst);
+}
+
+
+/**
+ * reactor_onread()
+ *   handle all of pipe msgs available in request pipe.
+ *
+ * returns:
+ *    0: success
+ *   -1: client closed or pipe error
+ */
+static int reactor_onread (pipe_instance_t *pipeinst)
+{
+    int more = 1;
+
+    if (pipeinst->shm) {
+        shm_drain_doorbell(pipeinst->requestfd);
+    }
+
+    while (more) {
+        int rc = pipe_instance_read(pipeinst, &more);
+
+        if (rc == -1 || (rc > 0 && pipe_instance_ondata(pipeinst) == -1)) {
+            return (-1);
+        }
+
+        if (__atomic_load_n(&pipeinst->outq.len, __ATOMIC_RELAXED) > 0) {
+            // client reads no more replies: rest waits in request pipe or ring
+            break;
+        }
+
+        if (! more && pipeinst->shm && ! shmring_sleep(&pipeinst->shm->rx)) {
+            // client wrote more before it saw us sleeping
+            more = 1;
+        }
+    }
+
+    pipe_instance_release(pipeinst);
+    return 0;
+}
+
+
+// pipeline: write out replies packed for pipe and drop reference to it
+static void reactor_done_flush (pipe_instance_t *txpipe, fifo_txbuf_t *tx)
+{
+    if (txpipe) {
+        pipe_instance_flush(txpipe, tx);
+        pipe_instance_free(txpipe);
+    }
+}
+
+
+/**
+ * reactor_ondone()
+ *   pipeline: write replies of requests done by workers. replies to a
+ *   pipe done together go out in one write. next request without id of
+ *   a pipe starts after reply to the last one is written.
+ */
+static void reactor_ondone (fifo_reactor_t *reactor)
+{
+    uint64_t count;
+    fifo_txbuf_t tx;
+    fifo_task_t *task, *next, *done = NULL;
+    pipe_instance_t *txpipe = NULL;
+
+    if (read(reactor->donefd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        printf("read eventfd failed: %s.\n", strerror(errno));
+    }
+
+    task = __atomic_exchange_n(&reactor->donelist, NULL, __ATOMIC_ACQUIRE);
+
+    // pushed as stack: reverse to order done
+    while (task) {
+        next = task->next;
+        task->next = done;
+        done = task;
+        task = next;
+    }
+
+    tx.len = 0;
+
+    for (task = done; task; task = next) {
+        pipe_request_t *req = (pipe_request_t *) task;
+        pipe_instance_t *pipeinst = req->pipeinst;
+
+        next = task->next;
+
+        if (pipeinst != txpipe) {
+            reactor_done_flush(txpipe, &tx);
+
+            // pipe lives until its replies are written
+            __atomic_add_fetch(&pipeinst->refc, 1, __ATOMIC_RELAXED);
+            txpipe = pipeinst;
+        }
+
+        if (pipeinst->viewcb) {
+            if (req->txlen > 0) {
+                if (tx.len + req->txlen > (int) sizeof(tx.buf)) {
+                    pipe_instance_flush(pipeinst, &tx);
+                }
+
+                memcpy(tx.buf + tx.len, req->reply, req->txlen);
+                tx.len += req->txlen;
+            }
+        } else if (req->reply->msgsz > 0) {
+            pipe_instance_pack(pipeinst, &tx, req->reply, &req->frame);
+        }
+
+        if (! (req->frame.flags & FIFO_FRAME_F_REQID)) {
+            fifo_task_t *wait = pipeinst->serialhead;
+
+            if (wait) {
+                // next request may write its reply by itself
+                pipe_instance_flush(pipeinst, &tx);
+
+                pipeinst->serialhead = wait->next;
+                if (! pipeinst->serialhead) {
+                    pipeinst->serialtail = NULL;
+                }
+
+                workpool_push(reactor->server->workpool, wait);
+            } else {
+                pipeinst->serialbusy = 0;
+            }
+        }
+
+        pipemsg_free(req->reply);
+
+        pipe_instance_free(pipeinst);
+        mem_pool_free(&requestpool, req);
+    }
+
+    reactor_done_flush(txpipe, &tx);
+}
+
+
+#ifdef FIFO_USE_IO_URING
+
+// user_data of write cqe has low bit set
+#define URING_UDATA(i, iswrite)   ((((uint64_t)(i)) << 1) | (iswrite))
+
+
+/**
+ * reactor_uring_wait()
+ *   submit prepared sqes and reap completions: result of read is stored
+ *   in rdres[i]; failed write marks pipe i as broken in wrres[i]. a pipe
+ *   write may complete short, the rest of wriov[i] is written at once.
+ */
+static int reactor_uring_wait (iouring_t *ring, int waitnr, pipe_instance_t **pipes, struct iovec *wriov, int *rdres, int *wrres)
+{
+    struct io_uring_cqe *cqe;
+
+    if (iouring_submit_and_wait(ring, (unsigned int) waitnr) == -1) {
+        printf("io_uring_enter failed: %s.\n", strerror(errno));
+        return (-1);
+    }
+
+    while ((cqe = iouring_peek_cqe(ring)) != NULL) {
+        int i = (int) (cqe->user_data >> 1);
+
+        if (cqe->user_data & 1) {
+            int res = (cqe->res == -EAGAIN? 0 : cqe->res);
+
+            if (res < 0) {
+                printf("write error: %s.\n", strerror(-res));
+                wrres[i] = -1;
+            } else if ((size_t) res < wriov[i].iov_len) {
+                wriov[i].iov_base = (char *) wriov[i].iov_base + res;
+                wriov[i].iov_len -= (size_t) res;
+
+                // pipe full: rest waits in outq
+                if (outq_writev(&pipes[i]->outq, &wriov[i], 1) != 0) {
+                    wrres[i] = -1;
+                }
+            }
+        } else {
+            rdres[i] = cqe->res;
+        }
+
+        iouring_cqe_seen(ring);
+    }
+
+    return 0;
+}
+
+
+// replies packed so far for pipe are written out at once
+static int reactor_uring_flush (fifo_reactor_t *reactor, pipe_instance_t *pipeinst, int txstart)
+{
+    struct iovec iov;
+
+    iov.iov_base = reactor->txbuf + txstart;
+    iov.iov_len = (size_t) (reactor->txlen - txstart);
+
+    reactor->txlen = txstart;
+
+    if (iov.iov_len > 0 && outq_writev(&pipeinst->outq, &iov, 1) != 0) {
+        return (-1);
+    }
+
+    return 0;
+}
+
+
+// replies packed so far for pipe are written out if no room for cbwrite
+static int reactor_uring_room (fifo_reactor_t *reactor, pipe_instance_t *pipeinst, int txstart, int cbwrite)
+{
+    if (reactor->txlen + cbwrite > FIFO_URING_TXBUF) {
+        return reactor_uring_flush(reactor, pipeinst, txstart);
+    }
+
+    return 0;
+}
+
+
+static int reactor_uring_pack (fifo_reactor_t *reactor, pipe_instance_t *pipeinst, int txstart, fifo_pipemsg_t *reply, const fifo_frame_t *frame)
+{
+    char hdr[8];
+    int hdrsz = frame_pack_header(hdr, reply, frame);
+    int cbwrite = hdrsz + reply->msgsz;
+
+    if (reactor_uring_room(reactor, pipeinst, txstart, cbwrite) != 0) {
+        return (-1);
+    }
+
+    memcpy(reactor->txbuf + reactor->txlen, hdr, hdrsz);
+    memcpy(reactor->txbuf + reactor->txlen + hdrsz, reply->msgbuf, reply->msgsz);
+    reactor->txlen += cbwrite;
+
+    return 0;
+}
+
+
+static int reactor_uring_onbatch (fifo_reactor_t *reactor, pipe_instance_t *pipeinst, int txstart, pipe_batch_t *batch)
+{
+    int i, rc = 0;
+
+    if (! batch) {
+        return 0;
+    }
+
+    pipe_batch_call(batch);
+
+    for (i = 0; i < batch->n && rc == 0; i++) {
+        if (batch->replies[i]->msgsz > 0) {
+            rc = reactor_uring_pack(reactor, pipeinst, txstart, batch->replies[i], &batch->frames[i]);
+        }
+    }
+
+    pipe_batch_free(batch);
+    return rc;
+}
+
+
+/**
+ * reactor_uring_ondata()
+ *   handle all of complete msgs in rxbuf of pipe. replies are packed
+ *   into reactor txbuf from txstart. if txbuf is full, replies packed
+ *   so far for this pipe are written out at once.
+ *
+ * returns:
+ *    0: success
+ *   -1: client closed or pipe error
+ */
+static int reactor_uring_ondata (fifo_reactor_t *reactor, pipe_instance_t *pipeinst, int txstart)
+{
+    int rc, bodysz;
+    const char *body;
+    fifo_frame_t frame;
+
+    pipe_batch_t *batch = NULL;
+
+    while ((rc = rxbuf_next(pipeinst->rx, &body, &bodysz, &frame)) == 1) {
+        if (bodysz == 0 && ! frame.flags) {
+            printf("client closed.\n");
+            reactor_uring_onbatch(reactor, pipeinst, txstart, batch);
+            return (-1);
+        }
+
+        if (pipe_instance_batchable(pipeinst, &frame)) {
+            batch = pipe_batch_add(batch, pipeinst, body, bodysz, &frame);
+
+            if (batch->n == pipeinst->batchsize) {
+                rc = reactor_uring_onbatch(reactor, pipeinst, txstart, batch);
+                batch = NULL;
+
+                if (rc != 0) {
+                    return (-1);
+                }
+            }
+            continue;
+        }
+
+        rc = reactor_uring_onbatch(reactor, pipeinst, txstart, batch);
+        batch = NULL;
+
+        if (rc != 0) {
+            return (-1);
+        }
+
+        if (frame.flags & FIFO_FRAME_F_ONEWAY) {
+            pipe_instance_onnotify(pipeinst, body, bodysz, &frame, NULL);
+            continue;
+        }
+
+        if (pipe_instance_viewable(pipeinst, &frame, NULL)) {
+            if (pipe_instance_onview(pipeinst, body, bodysz, &frame, reactor->txbuf, FIFO_URING_TXBUF, txstart, &reactor->txlen) != 0) {
+                return (-1);
+            }
+            continue;
+        }
+
+        pipe_instance_request(pipeinst)->msgsz = bodysz;
+        memcpy(pipeinst->request->msgbuf, body, bodysz);
+
+        if (! pipeinst->pipemsgcb || (frame.flags & FIFO_FRAME_F_MORE) || pipeinst->bigrequest.msgsz > 0) {
+            // large msgs: replies packed so far go first, then plain writes
+            fifo_txbuf_t tx;
+
+            if (reactor_uring_flush(reactor, pipeinst, txstart) != 0) {
+                return (-1);
+            }
+
+            tx.len = 0;
+            if (pipe_instance_onmsg(pipeinst, &frame, NULL, &tx) != 0 || txbuf_flush(&tx, pipeinst->replyfd, NULL, &pipeinst->outq) != 0) {
+                return (-1);
+            }
+
+            continue;
+        }
+
+        pipeinst->reply->msgsz = 0;
+
+        pipeinst->pipemsgcb(pipeinst->request, pipeinst->reply, pipeinst->argument);
+
+        request_arena_reset();
+
+        if (pipeinst->reply->msgsz > 0 && reactor_uring_pack(reactor, pipeinst, txstart, pipeinst->reply, &frame) != 0) {
+            return (-1);
+        }
+    }
+
+    if (reactor_uring_onbatch(reactor, pipeinst, txstart, batch) != 0) {
+        return (-1);
+    }
+
+    if (pipeinst->unacked) {
+        if (reactor_uring_room(reactor, pipeinst, txstart, FIFO_ACK_SIZE) != 0) {
+            return (-1);
+        }
+
+        reactor->txlen += pipe_instance_ack(pipeinst, reactor->txbuf + reactor->txlen);
+    }
+
+    return rc;
+}
+
+
+/**
+ * reactor_uring_writes()
+ *   prepare writes of replies packed for pipes in a round. io_uring
+ *   waits for room in a full pipe even if it is O_NONBLOCK, so pipes
+ *   found full by one poll() get their replies queued to outq instead
+ *   and are read no more. a pipe with room takes a short write at worst.
+ *
+ * returns:
+ *   number of writes prepared
+ */
+static int reactor_uring_writes (iouring_t *ring, pipe_instance_t **pipes, int npipes, struct iovec *wriov, int *wrres, char *active, int *nactive)
+{
+    int i, k, n = 0, nwrites = 0;
+
+    int index[FIFO_EPOLL_EVENTS];
+    struct pollfd pfds[FIFO_EPOLL_EVENTS];
+
+    for (i = 0; i < npipes; i++) {
+        if (wriov[i].iov_len > 0) {
+            pfds[n].fd = pipes[i]->replyfd;
+            pfds[n].events = POLLOUT;
+            pfds[n].revents = 0;
+            index[n++] = i;
+        }
+    }
+
+    if (n > 0 && poll(pfds, n, 0) == -1) {
+        printf("poll failed: %s.\n", strerror(errno));
+
+        for (k = 0; k < n; k++) {
+            pfds[k].revents = 0;
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        i = index[k];
+
+        if (pfds[k].revents & POLLOUT) {
+            iouring_prep_rw(iouring_get_sqe(ring), IORING_OP_WRITE, pipes[i]->replyfd,
+                wriov[i].iov_base, (unsigned int) wriov[i].iov_len, URING_UDATA(i, 1));
+            nwrites++;
+            continue;
+        }
+
+        if (outq_writev(&pipes[i]->outq, &wriov[i], 1) != 0) {
+            wrres[i] = -1;
+        }
+
+        wriov[i].iov_len = 0;
+
+        if (active[i]) {
+            active[i] = 0;
+            (*nactive)--;
+        }
+    }
+
+    return nwrites;
+}
+
+
+/**
+ * reactor_onready_uring()
+ *   handle ready pipes in batch: one io_uring_enter reads all pipes into
+ *   their rxbufs and writes back replies of previous round. all replies
+ *   of a pipe in a round go out in one write. pipes are read until
+ *   drained (or FIFO_URING_ROUNDS reads) then rearmed.
+ */
+static void reactor_onready_uring (fifo_reactor_t *reactor, pipe_instance_t **pipes, int npipes)
+{
+    int i, rounds, nactive, nwrites = 0;
+
+    int rdres[FIFO_EPOLL_EVENTS];
+    int wrres[FIFO_EPOLL_EVENTS];
+    int roomsz[FIFO_EPOLL_EVENTS];
+    struct iovec wriov[FIFO_EPOLL_EVENTS];
+    char active[FIFO_EPOLL_EVENTS];
+
+    iouring_t *ring = reactor->ring;
+
+    for (i = 0; i < npipes; i++) {
+        wrres[i] = 0;
+        active[i] = 1;
+    }
+
+    nactive = npipes;
+
+    for (rounds = 0; nactive > 0 && rounds < FIFO_URING_ROUNDS; rounds++) {
+        int nreads = 0;
+
+        for (i = 0; i < npipes; i++) {
+            if (active[i]) {
+                char *room;
+
+                pipe_instance_borrow(pipes[i]);
+                roomsz[i] = rxbuf_room(pipes[i]->rx, &room);
+
+                iouring_prep_rw(iouring_get_sqe(ring), IORING_OP_READ, pipes[i]->requestfd,
+                    room, (unsigned int) roomsz[i], URING_UDATA(i, 0));
+                nreads++;
+            }
+        }
+
+        if (reactor_uring_wait(ring, nreads + nwrites, pipes, wriov, rdres, wrres) == -1) {
+            return;
+        }
+
+        // all writes of last round completed
+        reactor->txlen = 0;
+        nwrites = 0;
+        nactive = 0;
+
+        for (i = 0; i < npipes; i++) {
+            int txstart = reactor->txlen;
+
+            wriov[i].iov_len = 0;
+
+            if (! active[i]) {
+                continue;
+            }
+
+            if (rdres[i] == -EAGAIN) {
+                active[i] = 0;
+                continue;
+            }
+
+            if (rdres[i] <= 0 || wrres[i]) {
+                wrres[i] = -1;
+                active[i] = 0;
+                continue;
+            }
+
+            pipes[i]->rx->tail += rdres[i];
+
+            if (reactor_uring_ondata(reactor, pipes[i], txstart) == -1) {
+                reactor->txlen = txstart;
+                wrres[i] = -1;
+                active[i] = 0;
+                continue;
+            }
+
+            if (pipes[i]->outq.len > 0) {
+                // replies queued before go first. client reads no more
+                //   replies: no more requests read either
+                if (reactor_uring_flush(reactor, pipes[i], txstart) != 0) {
+                    wrres[i] = -1;
+                }
+
+                active[i] = 0;
+                continue;
+            }
+
+            wriov[i].iov_base = reactor->txbuf + txstart;
+            wriov[i].iov_len = (size_t) (reactor->txlen - txstart);
+
+            if (rdres[i] < roomsz[i]) {
+                // drained
+                active[i] = 0;
+                continue;
+            }
+
+            nactive++;
+        }
+
+        nwrites = reactor_uring_writes(ring, pipes, npipes, wriov, wrres, active, &nactive);
+    }
+
+    if (nwrites) {
+        reactor_uring_wait(ring, nwrites, pipes, wriov, rdres, wrres);
+    }
+
+    for (i = 0; i < npipes; i++) {
+        pipe_instance_release(pipes[i]);
+
+        if (wrres[i] == 0 && reactor_rearm_pipe(pipes[i]) == 0) {
+            continue;
+        }
+
+        reactor_close_pipe(pipes[i]);
+    }
+}
+
+#endif /* FIFO_USE_IO_URING */
+
+
+/**
+ * server_reactor_cpu()
+ *   cpu reactor k runs on: cpus[k % numcpus], or null if not pinned.
+ */
+static const int * server_reactor_cpu (fifo_server server, int k)
+{
+    return (server->numcpus? &server->cpus[k % server->numcpus] : NULL);
+}
+
+
+/**
+ * server_colocate_reactor()
+ *   pick reactor which runs on cpu of client, or round robin if none.
+ */
+static fifo_reactor_t * server_colocate_reactor (fifo_server server, int cpu)
+{
+    int i;
+
+    for (i = 0; cpu != -1 && server->numcpus && i < server->numreactors; i++) {
+        int k = (int) ((server->nextreactor + i) % server->numreactors);
+
+        if (*server_reactor_cpu(server, k) == cpu) {
+            server->nextreactor += i + 1;
+            return &server->reactors[k];
+        }
+    }
+
+    return &server->reactors[server->nextreactor++ % server->numreactors];
+}
+
+
+/**
+ * reactor_onaccept()
+ *   accept all of clients waiting on accept pipe of reactor. clients
+ *   are spread over reactors by round robin, or kept in the reactor
+ *   which owns the lane if sharded. with colocate a client goes to a
+ *   reactor on its cpu if there is one.
+ */
+static void reactor_onaccept (fifo_reactor_t *acceptor)
+{
+    int rc, more = 1;
+    fifo_pipemsg_t clientmsg;
+    fifo_frame_t frame;
+    fifo_server server = acceptor->server;
+
+    while (more && server_accept_read(server, acceptor->lane_rx, acceptor->lane_pipefd, &more) > 0) {
+        while ((rc = rxbuf_decode(acceptor->lane_rx, &clientmsg, &frame)) == 1) {
+            pipe_instance_t *pipeinst;
+
+            if (clientmsg.msgsz == 0) {
+                continue;
+            }
+
+            pipeinst = server_accept_client(server, &clientmsg);
+
+            if (pipeinst) {
+                fifo_reactor_t *reactor = acceptor;
+
+                if (! server->sharded) {
+                    reactor = server_colocate_reactor(server, pipeinst->cpu);
+                }
+
+                if (reactor_add_pipe(reactor, pipeinst) == -1) {
+                    printf("epoll_ctl failed: %s.\n", strerror(errno));
+                    pipe_instance_free(pipeinst);
+                }
+            }
+        }
+
+        if (rc == -1) {
+            // drop garbage on accept pipe
+            acceptor->lane_rx->head = acceptor->lane_rx->tail;
+        }
+    }
+}
+
+
+typedef struct
+{
+    int epollfd;
+    struct epoll_event *events;
+} reactor_spin_arg_t;
+
+
+// pollfn of busy-poll: epoll without wait
+static int reactor_spin (void *arg)
+{
+    reactor_spin_arg_t *spinarg = (reactor_spin_arg_t *) arg;
+
+    return epoll_wait(spinarg->epollfd, spinarg->events, FIFO_EPOLL_EVENTS, 0);
+}
+
+
+/**
+ * reactor_poll()
+ *   wait for events on reactor and dispatch them.
+ *
+ * returns:
+ *   number of events handled, or -1 if error.
+ */
+static int reactor_poll (fifo_reactor_t *reactor, int timeout_ms)
+{
+    int i, nfds = 0;
+    struct epoll_event events[FIFO_EPOLL_EVENTS];
+
+#ifdef FIFO_USE_IO_URING
+    int npipes = 0;
+    pipe_instance_t *pipes[FIFO_EPOLL_EVENTS];
+#endif
+
+    if (reactor->spin.maxusec && timeout_ms != 0) {
+        reactor_spin_arg_t spinarg = {reactor->epollfd, events};
+
+        nfds = spin_poll(&reactor->spin, reactor_spin, &spinarg);
+    }
+
+    if (nfds == 0) {
+        nfds = epoll_wait(reactor->epollfd, events, FIFO_EPOLL_EVENTS, timeout_ms);
+
+        if (reactor->spin.maxusec && timeout_ms != 0) {
+            spin_waited(&reactor->spin);
+        }
+    }
+
+    if (nfds == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+
+        printf("epoll_wait failed: %s.\n", strerror(errno));
+        return (-1);
+    }
+
+    for (i = 0; i < nfds; i++) {
+        pipe_instance_t *pipeinst = (pipe_instance_t *) events[i].data.ptr;
+
+        if (! pipeinst) {
+            // accept pipe
+            reactor_onaccept(reactor);
+            continue;
+        }
+
+        if (events[i].data.ptr == (void *) reactor) {
+            if (__atomic_load_n(&reactor->server->stopping, __ATOMIC_ACQUIRE)) {
+                // woken up by fifo_server_free
+                return (-1);
+            }
+
+            // completion queue
+            reactor_ondone(reactor);
+            continue;
+        }
+
+        if (((fifo_task_t *) events[i].data.ptr)->taskfn == reactor_onwritable) {
+            // reply pipe has room for queued replies
+            reactor_onwritable((fifo_task_t *) events[i].data.ptr);
+            continue;
+        }
+
+        if (reactor->server->workpool && ! reactor->server->pipeline) {
+            // EPOLLONESHOT: pipe is not reported again until rearmed by worker
+            workpool_push(reactor->server->workpool, &pipeinst->task);
+            continue;
+        }
+
+    #ifdef FIFO_USE_IO_URING
+        if (reactor->ring && ! pipeinst->shm) {
+            // shared memory pipes need no batched syscalls
+            pipes[npipes++] = pipeinst;
+            continue;
+        }
+    #endif
+
+        reactor_onready(&pipeinst->task);
+    }
+
+#ifdef FIFO_USE_IO_URING
+    if (npipes) {
+        reactor_onready_uring(reactor, pipes, npipes);
+    }
+#endif
+
+    return nfds;
+}
+
+
+static void * reactor_thread (void *arg)
+{
+    fifo_reactor_t *reactor = (fifo_reactor_t *) arg;
+
+    printf("reactor_thread(%d) start...\n", reactor->index);
+
+    while (reactor_poll(reactor, FIFO_TIME_INFINITE) != -1) {
+        // forever
+    }
+
+    printf("reactor_thread(%d) exit.\n", reactor->index);
+
+    request_arena_free();
+    return NULL;
+}
+
+
+/**
+ * server_open_lanes()
+ *   create accept pipes "pipename-k" for reactors[k] (k > 0) if sharded.
+ *   reactors[0] always accepts on pipename.
+ */
+static int server_open_lanes (fifo_server server)
+{
+    int i;
+    char lane_fifo[FIFO_NAMELEN_MAX + 1];
+
+    server->reactors[0].lane_pipefd = server->accept_pipefd;
+    server->reactors[0].lane_rx = server->accept_rx;
+
+    for (i = 1; i < FIFO_REACTORS_MAX; i++) {
+        snprintf(lane_fifo, sizeof(lane_fifo), "%.*s-%d", server->namelen, server->pipename, i);
+
+        if (! server->sharded || i >= server->numreactors) {
+            // remove stale lanes left by last run so clients do not pick them
+            unlink(lane_fifo);
+            continue;
+        }
+
+        if (mkfifo(lane_fifo, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
+            printf("mkfifo failed: %s - %s.\n", strerror(errno), lane_fifo);
+            return FIFO_E_FAILED;
+        }
+
+        server->reactors[i].lane_pipefd = open(lane_fifo, O_NONBLOCK|O_RDWR);
+        if (server->reactors[i].lane_pipefd == -1) {
+            printf("open failed: %s - %s.\n", strerror(errno), lane_fifo);
+            return FIFO_E_FAILED;
+        }
+
+        server->reactors[i].lane_rx = rxbuf_new();
+    }
+
+    return FIFO_S_OK;
+}
+
+
+static int server_start_reactors (fifo_server server)
+{
+    int i;
+    struct epoll_event ev;
+
+    if (server->numworkers > 0) {
+        // workers run on cpus next to reactors
+        server->workpool = workpool_new(server->numworkers, server->steal, server->cpus, server->numcpus, server->numreactors);
+        if (! server->workpool) {
+            return FIFO_E_FAILED;
+        }
+
+        printf("server workpool start %d workers.\n", server->workpool->numworkers);
+    }
+
+    server->reactors = (fifo_reactor_t *) mem_alloc_zero(server->numreactors, sizeof(fifo_reactor_t));
+
+    for (i = 0; i < server->numreactors; i++) {
+        fifo_reactor_t *reactor = &server->reactors[i];
+
+        reactor->index = i;
+        reactor->server = server;
+        reactor->lane_pipefd = -1;
+        reactor->donefd = -1;
+
+        spin_init(&reactor->spin, server->busypoll, &server->spinstats);
+
+        reactor->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (reactor->epollfd == -1) {
+            printf("epoll_create1 failed: %s.\n", strerror(errno));
+            return FIFO_E_FAILED;
+        }
+
+        // completion queue in pipeline, wakeup to stop anyway
+        reactor->donefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = reactor;
+
+        if (reactor->donefd == -1 || epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->donefd, &ev) == -1) {
+            printf("eventfd failed: %s.\n", strerror(errno));
+            return FIFO_E_FAILED;
+        }
+
+    #ifdef FIFO_USE_IO_URING
+        // handlers run in workers do their own i/o
+        if (! server->workpool) {
+            reactor->ring = (iouring_t *) mem_alloc_zero(1, sizeof(iouring_t));
+
+            // reads and writes for all of events in one batch
+            if (iouring_init(reactor->ring, FIFO_EPOLL_EVENTS * 2) == -1) {
+                printf("io_uring not available (%s). fall back to read/write.\n", strerror(errno));
+                mem_free(reactor->ring);
+                reactor->ring = NULL;
+            } else {
+                reactor->txbuf = (char *) mem_alloc_unset(FIFO_URING_TXBUF);
+            }
+        }
+    #endif
+    }
+
+    if (server_open_lanes(server) != FIFO_S_OK) {
+        return FIFO_E_FAILED;
+    }
+
+    // accept pipe is owned by reactors[0], lanes by others if sharded
+    for (i = 0; i < server->numreactors; i++) {
+        fifo_reactor_t *reactor = &server->reactors[i];
+
+        if (reactor->lane_pipefd != -1) {
+            ev.events = EPOLLIN;
+
+        #ifdef EPOLLEXCLUSIVE
+            if (server->processes) {
+                // wake one of processes for a connect, not all of them
+                ev.events |= EPOLLEXCLUSIVE;
+            }
+        #endif
+            ev.data.ptr = NULL;
+
+            if (epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->lane_pipefd, &ev) == -1) {
+                printf("epoll_ctl failed: %s.\n", strerror(errno));
+                return FIFO_E_FAILED;
+            }
+        }
+    }
+
+    // reactors[0] is driven by caller thread
+    for (i = 1; i < server->numreactors; i++) {
+        fifo_reactor_t *reactor = &server->reactors[i];
+
+        if (thread_create(&reactor->thread, reactor_thread, (void*)reactor,
+                "reactor", i, server_reactor_cpu(server, i), (server->numcpus? 1 : 0)) != 0) {
+            printf("pthread_create failed.\n");
+            return FIFO_E_FAILED;
+        }
+
+        reactor->started = 1;
+    }
+
+    return FIFO_S_OK;
+}
+
+
+/**
+ * server_stop_reactors()
+ *   wake up all of reactors to stop and wait for reactor threads to
+ *   exit. reactors[0] stops in its caller, which must not be polling
+ *   it when server is freed.
+ */
+static void server_stop_reactors (fifo_server server)
+{
+    int i;
+    uint64_t one = 1;
+
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < server->numreactors; i++) {
+        fifo_reactor_t *reactor = &server->reactors[i];
+
+        if (reactor->donefd > 0 && write(reactor->donefd, &one, sizeof(one)) != sizeof(one)) {
+            printf("write eventfd failed: %s.\n", strerror(errno));
+        }
+    }
+
+    for (i = 1; i < server->numreactors; i++) {
+        fifo_reactor_t *reactor = &server->reactors[i];
+
+        if (reactor->started && ! pthread_equal(reactor->thread, pthread_self())) {
+            pthread_join(reactor->thread, NULL);
+            reactor->started = 0;
+        }
+    }
+}
+
+
+static void server_runreactors (fifo_server server, fifo_serverloop_cb servloopcb, void *loopcbarg)
+{
+    int rc, timeout_ms = FIFO_TIME_INFINITE;
+    cpu_set_t cpuset;
+
+    if (server_start_reactors(server) != FIFO_S_OK) {
+        return;
+    }
+
+    // caller thread drives reactors[0]: pinned as it but keeps its name
+    if (thread_cpuset(server_reactor_cpu(server, 0), (server->numcpus? 1 : 0), &cpuset) &&
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        printf("pthread_setaffinity_np failed: reactor(0) not pinned.\n");
+    }
+
+    if (server->connect_timeout.tv_sec >= 0) {
+        timeout_ms = (int)(server->connect_timeout.tv_sec * 1000 + server->connect_timeout.tv_usec / 1000);
+    }
+
+    while(! servloopcb || servloopcb(loopcbarg)) {
+        rc = reactor_poll(&server->reactors[0], timeout_ms);
+
+        if (rc == 0) {
+            // timeout with no ready
+            printf(".");
+        } else if (rc == -1) {
+            break;
+        }
+    }
+}
+
+#endif /* FIFO_HAVE_EPOLL */
+
+
+int fifo_server_new (const char *pathname, int client_timeout, int connect_timeout, fifo_server *server)
+{
+    return fifo_server_new_ex(pathname, client_timeout, connect_timeout, NULL, server);
+}
+
+
+/**
+ * server_parse_cpus()
+ *   parse cpu list like "0-3,6" into cpuset.
+ *
+ * returns:
+ *   number of cpus, or -1 if bad list.
+ */
+static int server_parse_cpus (const char *list, cpu_set_t *cpuset)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpuset);
+
+    do {
+        first = last = strtol(list, &end, 10);
+        if (end == list) {
+            return (-1);
+        }
+
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) {
+                return (-1);
+            }
+        }
+
+        if (first < 0 || last >= CPU_SETSIZE || first > last) {
+            return (-1);
+        }
+
+        for (; first <= last; first++) {
+            CPU_SET(first, cpuset);
+        }
+
+        list = end + 1;
+    } while (*end == ',');
+
+    return (*end? -1 : CPU_COUNT(cpuset));
+}
+
+
+static int server_has_cpu (fifo_server server, int cpu)
+{
+    int i;
+
+    for (i = 0; i < server->numcpus; i++) {
+        if (server->cpus[i] == cpu) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int fifo_server_new_ex (const char *pathname, int client_timeout, int connect_timeout, const fifo_server_opts_t *opts, fifo_server *server)
+{
+    fifo_server_t *srvr;
+    size_t namelen;
+    const char *pipename;
+
+    int cpu, numcpus = 0;
+    cpu_set_t cpuset, allowed;
+
+    fifo_server_opts_t srvopts = {0};
+
+    if (opts) {
+        memcpy(&srvopts, opts, sizeof(srvopts));
+    }
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        CPU_ZERO(&allowed);
+        for (cpu = 0; cpu < (int) sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    if (srvopts.cpus) {
+        numcpus = server_parse_cpus(srvopts.cpus, &cpuset);
+        if (numcpus <= 0) {
+            printf("bad cpu list: %s\n", srvopts.cpus);
+            return FIFO_E_BADARG;
+        }
+
+        // only cpus we may run on (taskset, cgroup cpuset)
+        CPU_AND(&cpuset, &cpuset, &allowed);
+
+        numcpus = CPU_COUNT(&cpuset);
+        if (numcpus == 0) {
+            printf("no cpu of list allowed: %s. threads not pinned.\n", srvopts.cpus);
+        }
+    } else if (srvopts.sharded) {
+        // sharded reactor k runs on k-th allowed cpu
+        memcpy(&cpuset, &allowed, sizeof(cpuset));
+        numcpus = CPU_COUNT(&cpuset);
+    }
+
+    if (srvopts.mode == FIFO_SERVER_MODE_DEFAULT) {
+    #ifdef FIFO_HAVE_EPOLL
+        srvopts.mode = FIFO_SERVER_MODE_REACTOR;
+    #else
+        srvopts.mode = FIFO_SERVER_MODE_THREADS;
+    #endif
+    }
+
+    if (srvopts.mode != FIFO_SERVER_MODE_THREADS && srvopts.mode != FIFO_SERVER_MODE_REACTOR) {
+        printf("bad server mode: %d\n", srvopts.mode);
+        return FIFO_E_BADARG;
+    }
+
+#ifndef FIFO_HAVE_EPOLL
+    if (srvopts.mode == FIFO_SERVER_MODE_REACTOR) {
+        printf("epoll not supported. use FIFO_SERVER_MODE_THREADS.\n");
+        srvopts.mode = FIFO_SERVER_MODE_THREADS;
+    }
+#endif
+
+    CHKCONFIG_INT_VALUE(1, 1, FIFO_REACTORS_MAX, srvopts.reactors);
+    CHKCONFIG_INT_VALUE(FIFO_BATCH_DEFAULT, 1, FIFO_BATCH_MAX, srvopts.batchsize);
+
+    if (srvopts.mode != FIFO_SERVER_MODE_REACTOR) {
+        srvopts.pipeline = 0;
+    } else if (srvopts.pipeline && srvopts.workers == 0) {
+        srvopts.workers = -1;
+    }
+
+    if (srvopts.workers < 0) {
+        srvopts.workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (srvopts.workers > FIFO_WORKERS_MAX) {
+        srvopts.workers = FIFO_WORKERS_MAX;
+    }
+
+    if (! pathname) {
+        pipename = FIFO_NAME_LINUX_DEFAULT;
+    } else {
+        pipename = pathname;
+    }
+
+    namelen = strnlen(pipename, FIFO_NAMELEN_MAX - 20);
+    srvr = mem_alloc_zero(1, sizeof(*srvr)+ namelen + 1);
+
+    srvr->namelen = (int) namelen;
+    memcpy(srvr->pipename, pipename, srvr->namelen);
+
+    srvr->mode = srvopts.mode;
+    srvr->sharded = srvopts.sharded? 1 : 0;
+    srvr->numreactors = srvopts.reactors;
+    srvr->numworkers = srvopts.workers;
+    srvr->batchsize = srvopts.batchsize;
+    srvr->pipeline = srvopts.pipeline? 1 : 0;
+    srvr->steal = srvopts.steal? 1 : 0;
+    srvr->busypoll = (srvopts.busypoll > 0? srvopts.busypoll : 0);
+    srvr->colocate = srvopts.colocate? 1 : 0;
+    memcpy(&srvr->cpuallowed, &allowed, sizeof(allowed));
+    srvr->owner = getpid();
+    srvr->processes = (srvopts.processes > 0? srvopts.processes : 0);
+
+    if (srvr->processes > FIFO_PROCESSES_MAX) {
+        srvr->processes = FIFO_PROCESSES_MAX;
+    }
+
+    if (numcpus > 0) {
+        srvr->cpus = (int *) mem_alloc_zero(numcpus, sizeof(int));
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpuset)) {
+                srvr->cpus[srvr->numcpus++] = cpu;
+            }
+        }
+    }
+
+    if (mkfifo(srvr->pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
+        printf("mkfifo failed: %s.\n", strerror(errno));
+        mem_free(srvr->cpus);
+        mem_free(srvr);
+        return FIFO_E_FAILED;
+    }
+
+    printf("open O_NONBLOCK|O_RDWR fifo: %s.\n", srvr->pipename);
+    srvr->accept_pipefd = open(srvr->pipename, O_NONBLOCK|O_RDWR);
+    if (srvr->accept_pipefd == -1) {
+        printf("open failed: %s.\n", strerror(errno));
+        fifo_server_free(srvr);
+        exit(EXIT_FAILURE);
+    }
+
+    srvr->accept_rx = rxbuf_new();
+
+    if (client_timeout < 0) {
+        // wait infinite
+        srvr->client_timeout.tv_sec = -1;
+    } else {
+        srvr->client_timeout.tv_sec = client_timeout / 1000;
+        srvr->client_timeout.tv_usec = (client_timeout % 1000) * 1000;
+    }
+
+    if (connect_timeout < 0) {
+        // wait infinite
+        srvr->connect_timeout.tv_sec = -1;
+    } else {
+        srvr->connect_timeout.tv_sec = connect_timeout / 1000;
+        srvr->connect_timeout.tv_usec = (connect_timeout % 1000) * 1000;
+    }
+
+    *server = srvr;
+    return FIFO_S_OK;
+}
+
+
+void fifo_server_free (fifo_server server)
+{
+#ifdef FIFO_HAVE_EPOLL
+    if (server->reactors) {
+        // no reactor hands out work or touches server from now on
+        server_stop_reactors(server);
+    }
+#endif
+
+    if (server->workpool) {
+        workpool_free(server->workpool);
+    }
+
+    if (server->reactors) {
+        int i;
+
+        for (i = 0; i < server->numreactors; i++) {
+            if (server->reactors[i].epollfd > 0) {
+                close(server->reactors[i].epollfd);
+            }
+
+            if (server->reactors[i].donefd > 0) {
+                close(server->reactors[i].donefd);
+            }
+
+            if (i > 0 && server->reactors[i].lane_pipefd > 0) {
+                close(server->reactors[i].lane_pipefd);
+                mem_free(server->reactors[i].lane_rx);
+            }
+
+        #ifdef FIFO_USE_IO_URING
+            if (server->reactors[i].ring) {
+                iouring_exit(server->reactors[i].ring);
+                mem_free(server->reactors[i].ring);
+                mem_free(server->reactors[i].txbuf);
+            }
+        #endif
+        }
+
+        mem_free(server->reactors);
+    }
+
+    if (server->accept_pipefd && server->accept_pipefd != -1) {
+        close(server->accept_pipefd);
+    }
+
+    mem_free(server->accept_rx);
+    mem_free(server->cpus);
+
+    // pipes are shared by worker processes: only creator removes them
+    if (getpid() == server->owner) {
+        int i;
+        char lane_fifo[FIFO_NAMELEN_MAX + 1];
+
+        for (i = 1; server->sharded && i < server->numreactors; i++) {
+            snprintf(lane_fifo, sizeof(lane_fifo), "%.*s-%d", server->namelen, server->pipename, i);
+            unlink(lane_fifo);
+        }
+
+        unlink(server->pipename);
+    }
+
+    mem_free(server);
+}
+
+
+void fifo_server_spin_stats (fifo_server server, fifo_spin_stats_t *stats)
+{
+    stats->spinusec = __atomic_load_n(&server->spinstats.spinusec, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&server->spinstats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&server->spinstats.misses, __ATOMIC_RELAXED);
+    stats->budget = server->spinstats.budget;
+}
+
+
+const char * fifo_server_get_pipename (fifo_server server)
+{
+    return (server? server->pipename : FIFO_NAME_LINUX_DEFAULT);
+}
+
+
+void fifo_server_runforever (fifo_server server, fifo_onpipemsg_cb pipemsgcb, void *argument, fifo_serverloop_cb servloopcb, void *loopcbarg)
+{
+    fifo_handler_t handler;
+
+    handler.pipemsgcb = pipemsgcb;
+    handler.msgbufcb = NULL;
+    handler.viewcb = NULL;
+    handler.pipemsgscb = NULL;
+    handler.notifycb = NULL;
+    handler.argument = argument;
+
+    fifo_server_runforever_ex(server, &handler, servloopcb, loopcbarg);
+}
+
+
+/**
+ * server_fork_worker()
+ *   fork worker process k.
+ *
+ * returns:
+ *   pid of worker in parent, 0 in worker, -1 if fork failed.
+ */
+static pid_t server_fork_worker (int k)
+{
+    pid_t pid, parent = getpid();
+
+    // log lines buffered so far are printed once, not once per worker
+    fflush(stdout);
+
+    pid = fork();
+
+    if (pid == 0) {
+    #if defined(__linux__)
+        // worker dies with parent
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+    #endif
+
+        if (getppid() != parent) {
+            // parent died before prctl
+            _exit(EXIT_FAILURE);
+        }
+
+        printf("worker process(%d) pid=%d start...\n", k, (int) getpid());
+    } else if (pid == -1) {
+        printf("fork failed: %s.\n", strerror(errno));
+    }
+
+    return pid;
+}
+
+
+/**
+ * server_runprocesses()
+ *   pre-fork: fork worker processes which serve on accept pipe shared
+ *   by them, then supervise them in caller process: a worker which
+ *   exits (crashed, killed or out of memory) is forked again, after a
+ *   second if it lived less than that. workers are killed when
+ *   servloopcb returns 0, which is called every FIFO_SUPERVISE_MSEC.
+ *
+ * returns:
+ *   in worker process only, which then serves as configured.
+ */
+static void server_runprocesses (fifo_server server, fifo_serverloop_cb servloopcb, void *loopcbarg)
+{
+    int k, status;
+    pid_t pid;
+    struct timeval timeout;
+    pthread_mutexattr_t attr;
+
+    pid_t *workers = (pid_t *) mem_alloc_zero(server->processes, sizeof(pid_t));
+    time_t *started = (time_t *) mem_alloc_zero(server->processes, sizeof(time_t));
+
+    server->acceptlock = (pthread_mutex_t *) mmap(NULL, sizeof(pthread_mutex_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (server->acceptlock == MAP_FAILED) {
+        printf("mmap failed: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(server->acceptlock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    for (k = 0; k < server->processes; k++) {
+        started[k] = time(NULL);
+
+        workers[k] = server_fork_worker(k);
+        if (workers[k] == 0) {
+            mem_free(workers);
+            mem_free(started);
+            return;
+        }
+    }
+
+    while (! servloopcb || servloopcb(loopcbarg)) {
+        if (! servloopcb) {
+            pid = waitpid(-1, &status, 0);
+        } else {
+            // check on workers and ask servloopcb in turn
+            pid = waitpid(-1, &status, WNOHANG);
+
+            if (pid == 0) {
+                timeout.tv_sec = 0;
+                timeout.tv_usec = FIFO_SUPERVISE_MSEC * 1000;
+
+                select(0, NULL, NULL, NULL, &timeout);
+                continue;
+            }
+        }
+
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            printf("waitpid failed: %s.\n", strerror(errno));
+            break;
+        }
+
+        for (k = 0; k < server->processes && workers[k] != pid; k++) {
+            // find worker
+        }
+
+        if (k == server->processes) {
+            // not a worker
+            continue;
+        }
+
+        printf("worker process(%d) pid=%d exit: status=%d. restart.\n", k, (int) pid, status);
+
+        if (time(NULL) - started[k] < 1) {
+            // crashes at start: do not fork in a loop
+            sleep(1);
+        }
+
+        started[k] = time(NULL);
+
+        workers[k] = server_fork_worker(k);
+        if (workers[k] == 0) {
+            mem_free(workers);
+            mem_free(started);
+            return;
+        }
+    }
+
+    for (k = 0; k < server->processes; k++) {
+        if (workers[k] > 0) {
+            kill(workers[k], SIGTERM);
+            waitpid(workers[k], &status, 0);
+        }
+    }
+
+    exit(EXIT_FAILURE);
+}
+
+
+void fifo_server_runforever_ex (fifo_server server, const fifo_handler_t *handler, fifo_serverloop_cb servloopcb, void *loopcbarg)
+{
+    int rc, more;
+    fd_set rfds;
+
+    fifo_pipemsg_t clientmsg;
+    fifo_frame_t frame;
+
+    if (! handler->pipemsgcb && ! handler->msgbufcb && ! handler->viewcb && ! handler->pipemsgscb && ! handler->notifycb) {
+        printf("no handler for msg.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    server->pipemsgcb = handler->pipemsgcb;
+    server->msgbufcb = handler->msgbufcb;
+    server->viewcb = handler->viewcb;
+    server->pipemsgscb = handler->pipemsgscb;
+    server->notifycb = handler->notifycb;
+    server->argument = handler->argument;
+
+    // write to a pipe closed by client fails with EPIPE instead of killing server
+    signal(SIGPIPE, SIG_IGN);
+
+    if (server->processes) {
+        server_runprocesses(server, servloopcb, loopcbarg);
+
+        // in worker process: serve until killed by parent
+        servloopcb = NULL;
+    }
+
+#ifdef FIFO_HAVE_EPOLL
+    if (server->mode == FIFO_SERVER_MODE_REACTOR) {
+        server_runreactors(server, servloopcb, loopcbarg);
+
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    while(! servloopcb || servloopcb(loopcbarg)) {
+        FD_ZERO(&rfds);
+        FD_SET(server->accept_pipefd, &rfds);
+
+        if (server->connect_timeout.tv_sec < 0) {
+            rc = select((int)server->accept_pipefd + 1, &rfds, NULL, NULL, NULL);
+        } else {
+            rc = select((int)server->accept_pipefd + 1, &rfds, NULL, NULL, &server->connect_timeout);
+        }
+
+        if (rc == 1) {
+            if (server_accept_read(server, server->accept_rx, server->accept_pipefd, &more) > 0) {
+                while ((rc = rxbuf_decode(server->accept_rx, &clientmsg, &frame)) == 1) {
+                    pthread_t thread;
+                    pipe_instance_t *pipeinst;
+
+                    int numcpus = server->numcpus;
+                    const int *cpus = server->cpus;
+
+                    if (clientmsg.msgsz == 0) {
+                        continue;
+                    }
+
+                    pipeinst = server_accept_client(server, &clientmsg);
+                    if (! pipeinst) {
+                        continue;
+                    }
+
+                    if (pipeinst->cpu != -1 && (! numcpus || server_has_cpu(server, pipeinst->cpu))) {
+                        // reply path on cpu of client
+                        cpus = &pipeinst->cpu;
+                        numcpus = 1;
+                    }
+
+                    if (thread_create(&thread, client_fifo_worker, (void*)pipeinst, "pipe", pipeinst->requestfd, cpus, numcpus) != 0) {
+                        printf("pthread_create failed.\n");
+
+                        pipe_instance_free(pipeinst);
+                        exit(EXIT_FAILURE);
+                    }
+
+                    // nobody joins client worker
+                    pthread_detach(thread);
+                }
+
+                if (rc == -1) {
+                    // drop garbage on accept pipe
+                    server->accept_rx->head = server->accept_rx->tail;
+                }
+            }
+        } else if (rc == 0) {
+            // timeout with no ready
+            printf(".");
+        } else {
+            printf("select failed: %s.\n", strerror(errno));
+            break;
+        }
+    }
+
+    exit(EXIT_FAILURE);
+}
+
+
+/**
+ * client_open_lane()
+ *   open accept pipe of server for connecting. if server is sharded,
+ *   lanes "pipename-1".."pipename-(n-1)" exist and client picks lane
+ *   by hash of pid. lane 0 and any lane not served go to pipename.
+ */
+static int client_open_lane (const char *pipename, int namelen, pid_t pid)
+{
+    int fd, lanes;
+    struct stat st;
+    char lane_fifo[FIFO_NAMELEN_MAX + 1];
+
+    for (lanes = 1; lanes < FIFO_REACTORS_MAX; lanes++) {
+        snprintf(lane_fifo, sizeof(lane_fifo), "%.*s-%d", namelen, pipename, lanes);
+
+        if (stat(lane_fifo, &st) != 0 || ! S_ISFIFO(st.st_mode)) {
+            break;
+        }
+    }
+
+    if (lanes > 1) {
+        // Knuth multiplicative hash
+        int lane = (int) ((((uint32_t) pid) * 2654435761u) % (uint32_t) lanes);
+
+        if (lane > 0) {
+            snprintf(lane_fifo, sizeof(lane_fifo), "%.*s-%d", namelen, pipename, lane);
+
+            // ENXIO: stale lane without reader
+            fd = open(lane_fifo, O_WRONLY|O_NONBLOCK);
+            if (fd != -1) {
+                return fd;
+            }
+        }
+    }
+
+    return open(pipename, O_WRONLY);
+}
+
+
+/**
+ * client_create_shm()
+ *   create shared memory with a pair of rings for client. the request
+ *   ring starts as waiting so the first request rings server doorbell.
+ */
+static fifo_shmhdr_t * client_create_shm (const char *shmname, int shmsize, size_t *mapsz)
+{
+    int shmfd;
+    uint32_t ringsz = FIFO_SHM_RING_MIN;
+    fifo_shmhdr_t *hdr;
+
+    while (ringsz < (uint32_t) shmsize && ringsz < FIFO_SHM_RING_MAX) {
+        ringsz <<= 1;
+    }
+
+    // left by a dead process with the same pid
+    shm_unlink(shmname);
+
+    shmfd = shm_open(shmname, O_CREAT|O_EXCL|O_RDWR, S_IRUSR|S_IWUSR);
+    if (shmfd == -1) {
+        printf("shm_open failed: %s - %s.\n", strerror(errno), shmname);
+        return NULL;
+    }
+
+    *mapsz = shm_mapsize(ringsz);
+
+    if (ftruncate(shmfd, (off_t) *mapsz) == -1) {
+        printf("ftruncate failed: %s - %s.\n", strerror(errno), shmname);
+        close(shmfd);
+        shm_unlink(shmname);
+        return NULL;
+    }
+
+    hdr = (fifo_shmhdr_t *) mmap(NULL, *mapsz, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
+    close(shmfd);
+
+    if (hdr == MAP_FAILED) {
+        printf("mmap failed: %s - %s.\n", strerror(errno), shmname);
+        shm_unlink(shmname);
+        return NULL;
+    }
+
+    hdr->magic = FIFO_SHM_MAGIC;
+    hdr->ringsz = ringsz;
+    hdr->rings[0].waiting = 1;
+
+    return hdr;
+}
+
+
+int fifo_client_new (const char *pathname, int wait_timeout, fifo_client *client)
+{
+    return fifo_client_new_ex(pathname, wait_timeout, NULL, client);
+}
+
+
+int fifo_client_new_ex (const char *pathname, int wait_timeout, const fifo_client_opts_t *opts, fifo_client *client)
+{
+    static int clientseq = 0;
+
+    fifo_client_t *clnt;
+
+    int writefd, namelen, pipelen, seq;
+
+    char client_pipename[FIFO_NAMELEN_MAX + 1];
+    const char *pipename;
+
+    char shmname[64];
+    size_t shmsz = 0;
+    fifo_shmhdr_t *shmhdr = NULL;
+
+    fifo_pipemsg_t clientmsg;
+
+    // pid = 12345
+    pid_t pid = getpid();
+
+    // pipename = "/tmp/namedpipe-default"
+    pipename = pathname? pathname : FIFO_NAME_LINUX_DEFAULT;
+    namelen = (int) strnlen(pipename, FIFO_NAMELEN_MAX - 20);
+    if (namelen == FIFO_NAMELEN_MAX - 20) {
+        printf("Invalid pipe name: %s.\n", pipename);
+        return FIFO_E_FAILED;
+    }
+
+    // more clients in one process: "/tmp/namedpipe-default.12345.1"
+    seq = __atomic_fetch_add(&clientseq, 1, __ATOMIC_RELAXED);
+
+    // client_pipename = "/tmp/namedpipe-default.12345"
+    if (seq == 0) {
+        pipelen = snprintf(client_pipename, FIFO_NAMELEN_MAX, "%.*s.%d", namelen, pipename, pid);
+    } else {
+        pipelen = snprintf(client_pipename, FIFO_NAMELEN_MAX, "%.*s.%d.%d", namelen, pipename, pid, seq);
+    }
+
+    clnt = mem_alloc_zero(1, sizeof(*clnt) + pipelen + 10);
+    clnt->namelen = pipelen;
+
+    // "/tmp/namedpipe-default.12345"
+    memcpy(clnt->pipename, client_pipename, clnt->namelen);
+    if (mkfifo(clnt->pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
+        printf("mkfifo failed: %s - %s.\n", strerror(errno), clnt->pipename);
+        mem_free(clnt);
+        return FIFO_E_FAILED;
+    }
+
+    // client_pipename = "/tmp/namedpipe-default.12345-read"
+    snprintf(client_pipename, FIFO_NAMELEN_MAX, "%.*s-read", clnt->namelen, clnt->pipename);
+    if (mkfifo(client_pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
+        printf("mkfifo failed: %s - %s.\n", strerror(errno), client_pipename);
+        unlink(client_pipename);
+        mem_free(clnt);
+        return FIFO_E_FAILED;
+    }
+
+    // pipes are there: fifo_client_free() cleans up from now on
+    clnt->rx = rxbuf_new();
+
+    clnt->readfd = open(client_pipename, O_NONBLOCK|O_RDWR);
+    if (clnt->readfd == -1) {
+        printf("open failed: %s.\n", strerror(errno));
+        fifo_client_free(clnt);
+        return FIFO_E_FAILED;
+    }
+
+    // O_WRONLY: "/tmp/namedpipe-default" or lane "/tmp/namedpipe-default-1"
+    writefd = client_open_lane(pipename, namelen, pid);
+    if (writefd == -1) {
+        printf("open failed: %s.\n", strerror(errno));
+        fifo_client_free(clnt);
+        return FIFO_E_FAILED;
+    }
+
+    // .12345
+    clientmsg.msgsz = clnt->namelen - namelen + 1;
+    memcpy(clientmsg.msgbuf, clnt->pipename + namelen, clientmsg.msgsz);
+
+    if (opts && opts->shmsize > 0) {
+        // .12345\0/fifo.12345.0\0
+        snprintf(shmname, sizeof(shmname), "/fifo.%d.%d", pid, seq);
+
+        shmhdr = client_create_shm(shmname, opts->shmsize, &shmsz);
+        if (shmhdr) {
+            memcpy(clientmsg.msgbuf + clientmsg.msgsz, shmname, strlen(shmname) + 1);
+            clientmsg.msgsz += (int32_t) strlen(shmname) + 1;
+        }
+    }
+
+    // .12345\0[/fifo.12345.0\0]@3\0: cpu we run on for server to colocate
+    if (sched_getcpu() != -1) {
+        clientmsg.msgsz += snprintf(clientmsg.msgbuf + clientmsg.msgsz, 16, "@%d", sched_getcpu()) + 1;
+    }
+
+    pipelen = (int) sizeof(clientmsg.msgsz) + (int) clientmsg.msgsz;
+
+    // connect to server
+    if (write(writefd, (char *)&clientmsg, pipelen) == pipelen) {
+        close(writefd);
+
+        // block here until server open the pipename
+        writefd = open(clnt->pipename, O_WRONLY);
+        if (writefd == -1) {
+            printf("open failed: %s.\n", strerror(errno));
+            if (shmhdr) {
+                munmap(shmhdr, shmsz);
+                shm_unlink(shmname);
+            }
+            fifo_client_free(clnt);
+            return FIFO_E_FAILED;
+        }
+
+        clnt->writefd = writefd;
+
+        if (shmhdr) {
+            // server attached before it opened the pipename
+            if (__atomic_load_n(&shmhdr->attached, __ATOMIC_ACQUIRE)) {
+                clnt->shm = shm_new(shmhdr, shmsz, 1, clnt->readfd, clnt->writefd);
+            } else {
+                printf("server not attached shared memory: use pipes.\n");
+                munmap(shmhdr, shmsz);
+            }
+
+            // both ends mapped: name is no longer needed
+            shm_unlink(shmname);
+        }
+
+        if (wait_timeout < 0) {
+            // wait infinite
+            clnt->wait_timeout.tv_sec = FIFO_TIME_INFINITE;
+        } else {
+            clnt->wait_timeout.tv_sec = wait_timeout / 1000;
+            clnt->wait_timeout.tv_usec = (wait_timeout % 1000) * 1000;
+        }
+
+        if (opts && opts->coalesce > 0) {
+            clnt->tx = (fifo_txbuf_t *) mem_alloc_unset(sizeof(fifo_txbuf_t));
+            clnt->tx->len = 0;
+
+            clnt->coalesce = (opts->coalesce < PIPEMSG_SIZE_MAX? opts->coalesce : PIPEMSG_SIZE_MAX);
+
+            clnt->linger = (opts->linger? opts->linger : FIFO_CLIENT_LINGER);
+            clnt->lingermax = clnt->linger;
+            clnt->adaptive = (opts->adaptive && clnt->linger > 0);
+        }
+
+        if (opts && opts->busypoll > 0) {
+            spin_init(&clnt->spin, opts->busypoll, &clnt->spinstats);
+        }
+
+        *client = clnt;
+        return FIFO_S_OK;
+    }
+
+    printf("write failed: %s.\n", strerror(errno));
+    close(writefd);
+    if (shmhdr) {
+        munmap(shmhdr, shmsz);
+        shm_unlink(shmname);
+    }
+    fifo_client_free(clnt);
+    return FIFO_E_FAILED;
+}
+
+
+void fifo_client_free (fifo_client client)
+{
+    if (client->readfd && client->readfd != -1) {
+        close(client->readfd);
+    }
+
+    if (client->writefd && client->writefd != -1) {
+        fifo_pipemsg_t eofmsg = {0};
+
+        fifo_client_write(client, &eofmsg);
+        fifo_client_flush(client);
+
+        close(client->writefd);
+    }
+
+    shm_free(client->shm);
+
+    unlink(client->pipename);
+
+    strcat(client->pipename, "-read");
+    unlink(client->pipename);
+
+    // calls never answered
+    while (client->callhead) {
+        fifo_call_t *call = client_call_unlink(client, client->callhead->reqid);
+
+        call->replycb(client, FIFO_E_FAILED, NULL, call->argument);
+        mem_pool_free(&callpool, call);
+    }
+    mem_free(client->calls);
+
+    mem_free(client->tx);
+    mem_free(client->rx);
+    mem_free(client);
+}
+
+
+/**
+ * client_flush()
+ *   write out coalesced requests in one write, which is atomic. async
+ *   client fails with EAGAIN if pipe or ring is full and keeps them.
+ */
+static int client_flush (fifo_client client)
+{
+    fifo_txbuf_t *tx = client->tx;
+
+    if (! tx || tx->len == 0) {
+        return FIFO_S_OK;
+    }
+
+    if (client->shm) {
+        struct iovec iov;
+
+        if (client->calls && shmring_room(&client->shm->tx) < (size_t) tx->len) {
+            errno = EAGAIN;
+            return FIFO_E_FAILED;
+        }
+
+        iov.iov_base = tx->buf;
+        iov.iov_len = (size_t) tx->len;
+
+        if (shmring_writev(&client->shm->tx, &iov, 1, -1) != 0) {
+            return FIFO_E_FAILED;
+        }
+    } else {
+        ssize_t count = write(client->writefd, tx->buf, tx->len);
+
+        if (count != (ssize_t) tx->len) {
+            if (count > 0) {
+                // keep only bytes not sent, rest goes by next flush
+                memmove(tx->buf, tx->buf + count, (size_t) (tx->len - count));
+                tx->len -= (int) count;
+                errno = EAGAIN;
+            }
+
+            return FIFO_E_FAILED;
+        }
+    }
+
+    tx->len = 0;
+
+    if (! client->flushstart) {
+        client->flushstart = client->txstart;
+    }
+
+    return FIFO_S_OK;
+}
+
+
+/**
+ * client_linger_adapt()
+ *   a reply arrived: sample latency of requests flushed since last one.
+ *   linger is halved when latency rises over twice its average, and
+ *   grows back slowly up to lingermax while it holds.
+ */
+static void client_linger_adapt (fifo_client client)
+{
+    int64_t lat;
+
+    if (! client->adaptive || ! client->flushstart) {
+        return;
+    }
+
+    lat = monotonic_usec() - client->flushstart;
+    client->flushstart = 0;
+
+    if (client->latency == 0) {
+        client->latency = lat;
+    }
+
+    if (lat > client->latency * 2) {
+        client->linger /= 2;
+    } else if (client->linger < client->lingermax) {
+        client->linger += client->lingermax / 16 + 1;
+
+        if (client->linger > client->lingermax) {
+            client->linger = client->lingermax;
+        }
+    }
+
+    client->latency += (lat - client->latency) / 8;
+}
+
+
+/**
+ * client_writev()
+ *   write one request frame gathered in iov. with coalescing a small one
+ *   is copied into tx, which goes out when full or linger expired. a
+ *   frame kept in tx is never failed, even if flush is deferred.
+ */
+static int client_writev (fifo_client client, const struct iovec *iov, int iovcnt, int cbframe)
+{
+    fifo_txbuf_t *tx = client->tx;
+
+    if (tx) {
+        if (tx->len + cbframe > client->coalesce && client_flush(client) != FIFO_S_OK) {
+            return FIFO_E_FAILED;
+        }
+
+        if (cbframe <= client->coalesce) {
+            int i;
+            int64_t now = monotonic_usec();
+
+            if (tx->len == 0) {
+                client->txstart = now;
+            }
+
+            for (i = 0; i < iovcnt; i++) {
+                memcpy(tx->buf + tx->len, iov[i].iov_base, iov[i].iov_len);
+                tx->len += (int) iov[i].iov_len;
+            }
+
+            if (tx->len >= client->coalesce || (client->linger >= 0 && now - client->txstart >= client->linger)) {
+                if (client_flush(client) != FIFO_S_OK && errno != EAGAIN) {
+                    // frame is last in tx and not sent: take it back so a
+                    //   retry by caller never sends it twice
+                    tx->len -= cbframe;
+                    return FIFO_E_FAILED;
+                }
+            }
+
+            return FIFO_S_OK;
+        }
+    }
+
+    if (client->shm) {
+        // async caller must not block on full ring
+        if (client->calls && shmring_room(&client->shm->tx) < (size_t) cbframe) {
+            errno = EAGAIN;
+            return FIFO_E_FAILED;
+        }
+
+        return (shmring_writev(&client->shm->tx, iov, iovcnt, -1) == 0? FIFO_S_OK : FIFO_E_FAILED);
+    }
+
+    if (writev(client->writefd, iov, iovcnt) == (ssize_t) cbframe) {
+        return FIFO_S_OK;
+    }
+
+    return FIFO_E_FAILED;
+}
+
+
+int fifo_client_flush (fifo_client client)
+{
+    return client_flush(client);
+}
+
+
+int fifo_client_write (fifo_client client, const fifo_pipemsg_t *msg)
+{
+    struct iovec iov;
+
+    if (msg->msgsz < 0 || msg->msgsz > (int32_t) sizeof(msg->msgbuf)) {
+        printf("bad size for msg: msgsz=%d\n", msg->msgsz);
+        return FIFO_E_BADARG;
+    }
+
+    iov.iov_base = (void *) msg;
+    iov.iov_len = sizeof(int32_t) + msg->msgsz;
+
+    return client_writev(client, &iov, 1, (int) iov.iov_len);
+}
+
+
+int fifo_client_write_batch (fifo_client client, const fifo_pipemsg_t *msgs[], int nmsgs)
+{
+    int i, n, cbwrite;
+    struct iovec iov[FIFO_BATCH_IOV];
+
+    for (i = 0; i < nmsgs; i++) {
+        if (msgs[i]->msgsz < 0 || msgs[i]->msgsz > (int32_t) sizeof(msgs[i]->msgbuf)) {
+            printf("bad size for msg: msgsz=%d\n", msgs[i]->msgsz);
+            return FIFO_E_BADARG;
+        }
+    }
+
+    if (client_flush(client) != FIFO_S_OK) {
+        return FIFO_E_FAILED;
+    }
+
+    i = 0;
+    while (i < nmsgs) {
+        // frames of one writev never exceed PIPEMSG_SIZE_MAX: write is atomic
+        n = 0;
+        cbwrite = 0;
+
+        while (i < nmsgs && n < FIFO_BATCH_IOV) {
+            int cbframe = (int) sizeof(int32_t) + msgs[i]->msgsz;
+
+            if (n > 0 && cbwrite + cbframe > PIPEMSG_SIZE_MAX) {
+                break;
+            }
+
+            iov[n].iov_base = (void *) msgs[i];
+            iov[n].iov_len = (size_t) cbframe;
+
+            cbwrite += cbframe;
+            n++;
+            i++;
+        }
+
+        if (client->shm) {
+            if (shmring_writev(&client->shm->tx, iov, n, -1) != 0) {
+                return FIFO_E_FAILED;
+            }
+        } else if (writev(client->writefd, iov, n) != (ssize_t) cbwrite) {
+            return FIFO_E_FAILED;
+        }
+    }
+
+    return FIFO_S_OK;
+}
+
+
+/**
+ * client_onack()
+ *   server acked one-way msgs up to frame reqid.
+ */
+static void client_onack (fifo_client client, const char *body, int bodysz, const fifo_frame_t *frame)
+{
+    client->acked = frame->reqid;
+
+    if (bodysz >= (int) sizeof(uint32_t)) {
+        memcpy(&client->lost, body, sizeof(uint32_t));
+    }
+}
+
+
+/**
+ * client_decode()
+ *   same as rxbuf_decode() but takes acks of one-way msgs on the way,
+ *   which are never returned as replies.
+ */
+static int client_decode (fifo_client client, fifo_pipemsg_t *msg, fifo_frame_t *frame)
+{
+    int rc;
+
+    while ((rc = rxbuf_decode(client->rx, msg, frame)) == 1 && (frame->flags & FIFO_FRAME_F_ACK)) {
+        client_onack(client, msg->msgbuf, msg->msgsz, frame);
+    }
+
+    return rc;
+}
+
+
+// pollfn of busy-poll: read reply pipe
+static int client_spin (void *arg)
+{
+    int more;
+    fifo_client client = (fifo_client) arg;
+
+    return rxbuf_read(client->rx, client->readfd, &more);
+}
+
+
+/**
+ * client_read_frame()
+ *   return next reply frame received. replies which arrive in one read
+ *   are kept in client rxbuf for next calls.
+ */
+static int client_read_frame (fifo_client client, fifo_pipemsg_t *msg, fifo_frame_t *frame)
+{
+    int rc, more;
+    fd_set rfds;
+    struct timeval timeout;
+
+    while ((rc = client_decode(client, msg, frame)) == 0) {
+        // requests kept for coalescing go before waiting for replies
+        if (client_flush(client) != FIFO_S_OK) {
+            return FIFO_E_FAILED;
+        }
+
+        if (client->shm && (rxbuf_read_shm(client->rx, &client->shm->rx, &more) > 0 ||
+            ! shmring_sleep(&client->shm->rx))) {
+            // replies in ring: no wait
+            continue;
+        }
+
+        if (client->spin.maxusec && ! client->shm) {
+            rc = spin_poll(&client->spin, client_spin, client);
+
+            if (rc > 0) {
+                continue;
+            }
+            if (rc == -1) {
+                printf("Application fatal error.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        FD_ZERO(&rfds);
+        FD_SET(client->readfd, &rfds);
+
+        if (client->wait_timeout.tv_sec < 0) {
+            rc = select(client->readfd + 1, &rfds, NULL, NULL, NULL);
+        } else {
+            // select may modify timeout
+            timeout = client->wait_timeout;
+            rc = select(client->readfd + 1, &rfds, NULL, NULL, &timeout);
+        }
+
+        if (client->spin.maxusec && ! client->shm) {
+            spin_waited(&client->spin);
+        }
+
+        if (rc == 0) {
+            return FIFO_E_TIMEOUT;
+        }
+        if (rc != 1) {
+            return FIFO_E_FAILED;
+        }
+
+        if (client->shm) {
+            shm_drain_doorbell(client->readfd);
+            continue;
+        }
+
+        if (rxbuf_read(client->rx, client->readfd, &more) == -1) {
+            printf("Application fatal error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (rc == -1) {
+        // stream is out of sync: drop what was received
+        client->rx->head = client->rx->tail;
+        return FIFO_E_FAILED;
+    }
+
+    client_linger_adapt(client);
+
+    return FIFO_S_OK;
+}
+
+
+int fifo_client_read (fifo_client client, fifo_pipemsg_t *msg)
+{
+    fifo_frame_t frame;
+
+    return client_read_frame(client, msg, &frame);
+}
+
+
+int fifo_client_send (fifo_client client, const fifo_pipemsg_t *msg, uint32_t *reqid)
+{
+    char hdr[8];
+    struct iovec iov[2];
+    fifo_frame_t frame;
+
+    if (msg->msgsz < 0 || msg->msgsz > PIPEMSG_REQID_BODY_MAX) {
+        printf("bad size for msg: msgsz=%d\n", msg->msgsz);
+        return FIFO_E_BADARG;
+    }
+
+    frame.flags = FIFO_FRAME_F_REQID;
+    frame.reqid = ++client->nextreqid;
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = frame_pack_header(hdr, (fifo_pipemsg_t *) msg, &frame);
+
+    iov[1].iov_base = (void *) msg->msgbuf;
+    iov[1].iov_len = msg->msgsz;
+
+    if (client_writev(client, iov, 2, (int) (iov[0].iov_len + iov[1].iov_len)) != FIFO_S_OK) {
+        return FIFO_E_FAILED;
+    }
+
+    if (reqid) {
+        *reqid = frame.reqid;
+    }
+
+    return FIFO_S_OK;
+}
+
+
+int fifo_client_recv (fifo_client client, fifo_pipemsg_t *msg, uint32_t *reqid)
+{
+    int rc;
+    fifo_frame_t frame;
+
+    rc = client_read_frame(client, msg, &frame);
+
+    if (rc == FIFO_S_OK && reqid) {
+        *reqid = frame.reqid;
+    }
+
+    return rc;
+}
+
+
+int fifo_client_writev (fifo_client client, const struct iovec *iov, int n)
+{
+    int i;
+    size_t msgsz = 0;
+    fifo_frame_t frame;
+
+    for (i = 0; i < n; i++) {
+        msgsz += iov[i].iov_len;
+    }
 
-    clnt = mem_alloc_zero(1, sizeof(*clnt) + pipelen + 10);
-    clnt->namelen = pipelen;
+    if (msgsz > FIFO_MSGBUF_MAX) {
+        printf("msg too large: %" PRIu64 " bytes.\n", (uint64_t) msgsz);
+        return FIFO_E_BADARG;
+    }
 
-    // "/tmp/namedpipe-default.12345"
-    memcpy(clnt->pipename, client_pipename, clnt->namelen);
-    if (mkfifo(clnt->pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
-        printf("mkfifo failed: %s - %s.\n", strerror(errno), clnt->pipename);
-        mem_free(clnt);
-        return FIFO_E_FAILED;
+    if (msgsz == 0) {
+        // empty frame tells server that client closed
+        return FIFO_E_BADARG;
     }
 
-    // client_pipename = "/tmp/namedpipe-default.12345-read"
-    snprintf(client_pipename, FIFO_NAMELEN_MAX, "%.*s-read", clnt->namelen, clnt->pipename);
-    if (mkfifo(client_pipename, FIFO_FILE_MODE) < 0 && errno != EEXIST) {
-        printf("mkfifo failed: %s - %s.\n", strerror(errno), client_pipename);
-        unlink(client_pipename);
-        mem_free(clnt);
+    frame.flags = 0;
+    frame.reqid = 0;
+
+    if (client_flush(client) != FIFO_S_OK ||
+        frame_writev_chunks(client->writefd, client->shm? &client->shm->tx : NULL, NULL, iov, msgsz, &frame) != 0) {
         return FIFO_E_FAILED;
     }
-    clnt->readfd = open(client_pipename, O_NONBLOCK|O_RDWR);
-    if (clnt->readfd == -1) {
-        printf("open failed: %s.\n", strerror(errno));
-        fifo_client_free(clnt);
-        return FIFO_E_FAILED;
+
+    return FIFO_S_OK;
+}
+
+
+int fifo_client_sendmsg (fifo_client client, const char *msgbuf, size_t msgsz)
+{
+    fifo_frame_t frame;
+
+    if (msgsz > FIFO_MSGBUF_MAX) {
+        printf("msg too large: %" PRIu64 " bytes.\n", (uint64_t) msgsz);
+        return FIFO_E_BADARG;
     }
 
-    // O_WRONLY: "/tmp/namedpipe-default"
-    writefd = open(pipename, O_WRONLY);
-    if (writefd == -1) {
-        printf("open failed: %s.\n", strerror(errno));
-        fifo_client_free(clnt);
+    if (msgsz == 0) {
+        // empty frame tells server that client closed
+        return FIFO_E_BADARG;
+    }
+
+    frame.flags = 0;
+    frame.reqid = 0;
+
+    if (client_flush(client) != FIFO_S_OK ||
+        frame_write_chunks(client->writefd, client->shm? &client->shm->tx : NULL, NULL, msgbuf, msgsz, &frame) != 0) {
         return FIFO_E_FAILED;
     }
 
-    // .12345
-    clientmsg.msgsz = clnt->namelen - namelen + 1;
-    memcpy(clientmsg.msgbuf, clnt->pipename + namelen, clientmsg.msgsz);
+    return FIFO_S_OK;
+}
 
-    pipelen = (int) sizeof(clientmsg.msgsz) + (int) clientmsg.msgsz;
 
-    // connect to server
-    if (write(writefd, (char *)&clientmsg, pipelen) == pipelen) {
-        close(writefd);
+int fifo_client_recvmsg (fifo_client client, fifo_msgbuf_t *msg)
+{
+    int rc;
+    fifo_frame_t frame;
+    fifo_pipemsg_t chunk;
 
-        // block here until server open the pipename
-        writefd = open(clnt->pipename, O_WRONLY);
-        if (writefd == -1) {
-            printf("open failed: %s.\n", strerror(errno));
-            fifo_client_free(clnt);
+    msg->msgsz = 0;
+
+    do {
+        rc = client_read_frame(client, &chunk, &frame);
+        if (rc != FIFO_S_OK) {
+            return rc;
+        }
+
+        if (msgbuf_append(msg, chunk.msgbuf, chunk.msgsz) != 0) {
             return FIFO_E_FAILED;
         }
+    } while (frame.flags & FIFO_FRAME_F_MORE);
 
-        clnt->writefd = writefd;
+    return FIFO_S_OK;
+}
 
-        if (wait_timeout < 0) {
-            // wait infinite
-            clnt->wait_timeout.tv_sec = FIFO_TIME_INFINITE;
-        } else {
-            clnt->wait_timeout.tv_sec = wait_timeout / 1000;
-            clnt->wait_timeout.tv_usec = (wait_timeout % 1000) * 1000;
+
+static int64_t monotonic_msec (void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+static void client_call_link (fifo_client client, fifo_call_t *call)
+{
+    fifo_call_t **bucket = &client->calls[call->reqid & (FIFO_CALL_BUCKETS - 1)];
+
+    call->hashnext = *bucket;
+    *bucket = call;
+
+    call->next = NULL;
+    call->prev = client->calltail;
+
+    if (client->calltail) {
+        client->calltail->next = call;
+    } else {
+        client->callhead = call;
+    }
+    client->calltail = call;
+
+    client->numcalls++;
+}
+
+
+static fifo_call_t * client_call_unlink (fifo_client client, uint32_t reqid)
+{
+    fifo_call_t *call, **link = &client->calls[reqid & (FIFO_CALL_BUCKETS - 1)];
+
+    while ((call = *link) != NULL) {
+        if (call->reqid == reqid) {
+            *link = call->hashnext;
+
+            if (call->prev) {
+                call->prev->next = call->next;
+            } else {
+                client->callhead = call->next;
+            }
+
+            if (call->next) {
+                call->next->prev = call->prev;
+            } else {
+                client->calltail = call->prev;
+            }
+
+            client->numcalls--;
+            return call;
         }
 
-        *client = clnt;
-        return FIFO_S_OK;
+        link = &call->hashnext;
     }
 
-    printf("write failed: %s.\n", strerror(errno));
-    close(writefd);
-    fifo_client_free(clnt);
-    return FIFO_E_FAILED;
+    return NULL;
 }
 
 
-void fifo_client_free (fifo_client client)
+/**
+ * client_call_dispatch()
+ *   complete calls for all of replies in client rxbuf. replies to calls
+ *   already expired are dropped.
+ *
+ * returns:
+ *   number of calls completed, or -1 if bad frame.
+ */
+static int client_call_dispatch (fifo_client client)
 {
-    if (client->readfd && client->readfd != -1) {
-        close(client->readfd);
+    int rc, done = 0;
+    fifo_frame_t frame;
+    fifo_pipemsg_t reply;
+
+    while ((rc = client_decode(client, &reply, &frame)) == 1) {
+        fifo_call_t *call;
+
+        if (! (frame.flags & FIFO_FRAME_F_REQID)) {
+            continue;
+        }
+
+        client_linger_adapt(client);
+
+        call = client_call_unlink(client, frame.reqid);
+        if (call) {
+            call->replycb(client, FIFO_S_OK, &reply, call->argument);
+            mem_pool_free(&callpool, call);
+            done++;
+        }
     }
 
-    if (client->writefd && client->writefd != -1) {
-        fifo_pipemsg_t eofmsg = {0};
+    if (rc == -1) {
+        client->rx->head = client->rx->tail;
+        return (-1);
+    }
 
-        fifo_client_write(client, &eofmsg);
+    return done;
+}
 
-        close(client->writefd);
+
+static int client_call_expire (fifo_client client, int64_t now)
+{
+    int done = 0;
+    fifo_call_t *call;
+
+    while ((call = client->callhead) != NULL && call->deadline && call->deadline <= now) {
+        client_call_unlink(client, call->reqid);
+
+        call->replycb(client, FIFO_E_TIMEOUT, NULL, call->argument);
+        mem_pool_free(&callpool, call);
+        done++;
     }
 
-    unlink(client->pipename);
+    return done;
+}
 
-    strcat(client->pipename, "-read");
-    unlink(client->pipename);
 
-    mem_free(client);
+// read replies from shared memory ring or reply pipe
+static int client_read (fifo_client client, int *more)
+{
+    if (client->shm) {
+        return rxbuf_read_shm(client->rx, &client->shm->rx, more);
+    }
+
+    return rxbuf_read(client->rx, client->readfd, more);
 }
 
 
-int fifo_client_write (fifo_client client, const fifo_pipemsg_t *msg)
+/**
+ * client_take_acks()
+ *   take acks of one-way msgs received so far without waiting, so reply
+ *   pipe never fills up with them while client only sends. acks behind
+ *   a reply are left for the reader of it.
+ */
+static void client_take_acks (fifo_client client)
 {
-    ssize_t cbwrite;
+    char *room;
+    int more, head, readable = 1;
 
-    if (msg->msgsz < 0 || msg->msgsz > sizeof(msg->msgbuf)) {
-        printf("bad size for msg: msgsz=%d\n", msg->msgsz);
+    const char *body;
+    int bodysz;
+    fifo_frame_t frame;
+
+    if (! client->shm) {
+        struct pollfd pfd;
+
+        pfd.fd = client->readfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        readable = (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN));
+    }
+
+    if (readable && rxbuf_room(client->rx, &room) > 0) {
+        client_read(client, &more);
+    }
+
+    for (;;) {
+        head = client->rx->head;
+
+        if (rxbuf_next(client->rx, &body, &bodysz, &frame) != 1) {
+            client->rx->head = head;
+            break;
+        }
+
+        if (! (frame.flags & FIFO_FRAME_F_ACK)) {
+            client->rx->head = head;
+            break;
+        }
+
+        client_onack(client, body, bodysz, &frame);
+    }
+}
+
+
+int fifo_client_notify (fifo_client client, const char *msg, int msgsz)
+{
+    char hdr[8];
+    struct iovec iov[2];
+
+    if (msgsz < 0 || msgsz > PIPEMSG_REQID_BODY_MAX) {
+        printf("bad size for msg: msgsz=%d\n", msgsz);
         return FIFO_E_BADARG;
     }
 
-    cbwrite = sizeof(int32_t) + msg->msgsz;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = frame_header(hdr, FIFO_FRAME_F_ONEWAY|FIFO_FRAME_F_REQID, client->notifyseq + 1, msgsz);
 
-    if (write(client->writefd, msg, cbwrite) == cbwrite) {
-        return FIFO_S_OK;
+    iov[1].iov_base = (void *) msg;
+    iov[1].iov_len = msgsz;
+
+    if (client_writev(client, iov, 2, (int) (iov[0].iov_len + msgsz)) != FIFO_S_OK) {
+        return FIFO_E_FAILED;
     }
 
-    return FIFO_E_FAILED;
+    if (++client->notifyseq % FIFO_ACK_TAKE == 0) {
+        client_take_acks(client);
+    }
+
+    return FIFO_S_OK;
 }
 
 
-int fifo_client_read (fifo_client client, fifo_pipemsg_t *msg)
+void fifo_client_notify_stats (fifo_client client, fifo_notify_stats_t *stats)
+{
+    client_take_acks(client);
+
+    stats->sent = client->notifyseq;
+    stats->acked = client->acked;
+    stats->lost = client->lost;
+}
+
+
+void fifo_client_spin_stats (fifo_client client, fifo_spin_stats_t *stats)
+{
+    *stats = client->spinstats;
+}
+
+
+static int client_call_onread (fifo_client client)
+{
+    int more = 1, done = 0;
+
+    while (more && client_read(client, &more) > 0) {
+        int rc = client_call_dispatch(client);
+        if (rc > 0) {
+            done += rc;
+        }
+    }
+
+    return done;
+}
+
+
+int fifo_client_call_async (fifo_client client, const fifo_pipemsg_t *msg, fifo_onreply_cb replycb, void *argument)
 {
     int rc;
-    fd_set rfds;
+    uint32_t reqid;
+    fifo_call_t *call;
 
-    FD_ZERO(&rfds);
-    FD_SET(client->readfd, &rfds);
+    // waits for room in pipe never last longer than wait_timeout
+    int64_t deadline = -1;
 
-    if (client->wait_timeout.tv_sec < 0) {
-        rc = select(client->readfd + 1, &rfds, NULL, NULL, NULL);
-    } else {
-        rc = select(client->readfd + 1, &rfds, NULL, NULL, &client->wait_timeout);
+    if (! replycb) {
+        return FIFO_E_BADARG;
     }
 
-    if (rc == 1) {
-        ssize_t count = read(client->readfd, msg, sizeof(*msg));
+    if (! client->calls) {
+        client->calls = (fifo_call_t **) mem_alloc_zero(FIFO_CALL_BUCKETS, sizeof(fifo_call_t *));
 
-        if (count == 0) {
-            msg->msgsz = 0;
-        } else if (count > 0) {
-            msg->msgsz = count - sizeof(msg->msgsz);
-        } else {
-            printf("Application fatal error.\n");
-            exit(EXIT_FAILURE);
+        // request pipe may be full while server waits for us to read
+        // replies: never block on write but read replies meanwhile.
+        fcntl(client->writefd, F_SETFL, fcntl(client->writefd, F_GETFL) | O_NONBLOCK);
+    }
+
+    while ((rc = fifo_client_send(client, msg, &reqid)) == FIFO_E_FAILED && errno == EAGAIN) {
+        int64_t wait = -1;
+        struct pollfd pfds[2];
+
+        if (client->wait_timeout.tv_sec >= 0) {
+            int64_t now = monotonic_msec();
+
+            if (deadline == -1) {
+                deadline = now + client->wait_timeout.tv_sec * 1000 + client->wait_timeout.tv_usec / 1000;
+            }
+
+            if (now >= deadline) {
+                // server stalled: request not sent
+                return FIFO_E_TIMEOUT;
+            }
+
+            wait = deadline - now;
         }
 
-        return FIFO_S_OK;
-    } else if (rc == 0) {
-        return FIFO_E_TIMEOUT;
+        if (client->shm) {
+            // ring full: take replies so server can go on
+            if (client_call_onread(client) == 0) {
+                sched_yield();
+            }
+            continue;
+        }
+
+        pfds[0].fd = client->writefd;
+        pfds[0].events = POLLOUT;
+        pfds[1].fd = client->readfd;
+        pfds[1].events = POLLIN;
+
+        if (poll(pfds, 2, (int) wait) == -1 && errno != EINTR) {
+            return FIFO_E_FAILED;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            client_call_onread(client);
+        }
     }
 
-    return FIFO_E_FAILED;
+    if (rc != FIFO_S_OK) {
+        return rc;
+    }
+
+    call = (fifo_call_t *) mem_pool_alloc(&callpool);
+
+    call->reqid = reqid;
+    call->deadline = 0;
+    call->replycb = replycb;
+    call->argument = argument;
+
+    if (client->wait_timeout.tv_sec >= 0) {
+        call->deadline = monotonic_msec() + client->wait_timeout.tv_sec * 1000 + client->wait_timeout.tv_usec / 1000;
+    }
+
+    client_call_link(client, call);
+
+    return FIFO_S_OK;
+}
+
+
+int fifo_client_poll (fifo_client *clients, int numclients, int timeout)
+{
+    int i, rc, done = 0;
+    int64_t now, wait = timeout;
+
+    struct pollfd pfdsbuf[FIFO_POLL_CLIENTS];
+    struct pollfd *pfds = pfdsbuf;
+
+    if (numclients > FIFO_POLL_CLIENTS) {
+        pfds = (struct pollfd *) mem_alloc_unset(sizeof(*pfds) * numclients);
+    }
+
+    now = monotonic_msec();
+
+    for (i = 0; i < numclients; i++) {
+        fifo_call_t *call = clients[i]->callhead;
+
+        // never sleep past the earliest deadline
+        if (call && call->deadline) {
+            int64_t left = call->deadline > now? call->deadline - now : 0;
+            if (wait < 0 || left < wait) {
+                wait = left;
+            }
+        }
+
+        // coalesced requests go before waiting for their replies
+        if (client_flush(clients[i]) != FIFO_S_OK && (wait < 0 || wait > 1)) {
+            // pipe is full: try again soon
+            wait = 1;
+        }
+
+        if (clients[i]->shm && ! shmring_sleep(&clients[i]->shm->rx)) {
+            // replies in ring: no wait
+            wait = 0;
+        }
+
+        pfds[i].fd = clients[i]->readfd;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    rc = poll(pfds, numclients, (int) wait);
+    if (rc == -1 && errno != EINTR) {
+        printf("poll error: %s.\n", strerror(errno));
+        done = FIFO_E_FAILED;
+        goto exit_free;
+    }
+
+    now = monotonic_msec();
+
+    for (i = 0; i < numclients; i++) {
+        if (rc > 0 && (pfds[i].revents & POLLIN)) {
+            if (clients[i]->shm) {
+                shm_drain_doorbell(clients[i]->readfd);
+            }
+            done += client_call_onread(clients[i]);
+        } else if (clients[i]->shm) {
+            done += client_call_onread(clients[i]);
+        }
+
+        done += client_call_expire(clients[i], now);
+    }
+
+exit_free:
+    if (pfds != pfdsbuf) {
+        mem_free(pfds);
+    }
+
+    return done;
+}
+
+
+int fifo_client_pending (fifo_client client)
+{
+    return client->numcalls;
 }
 
 
 const char * fifo_client_get_pipename (fifo_client client)
 {
     return (client? client->pipename : FIFO_NAME_LINUX_DEFAULT);
+}
+
+
+static void print_pool (const char *name, mem_pool_t *pool)
+{
+    mem_pool_stats_t stats;
+
+    mem_pool_get_stats(pool, &stats);
+
+    printf("pool %-8s objsz=%-6" PRIu64 " allocs=%-10" PRIu64 " hits=%5.1f%% refills=%-8" PRIu64 " flushes=%-8" PRIu64 " slabs=%" PRIu64 "\n",
+        name, (uint64_t) pool->objsz, stats.allocs, stats.allocs? stats.hits * 100.0 / stats.allocs : 0.0,
+        stats.refills, stats.flushes, stats.slabs);
+}
+
+
+void fifo_print_pools (void)
+{
+    print_pool("pipe", &pipeinstpool);
+    print_pool("request", &requestpool);
+    print_pool("batch", &batchpool);
+    print_pool("rxbuf", &rxbufpool);
+    print_pool("pipemsg", &pipemsgpool);
+    print_pool("token", &tokenpool);
+    print_pool("call", &callpool);
 }
\ No newline at end of file
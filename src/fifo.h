@@ -43,6 +43,10 @@ extern "C"
 #include <stdio.h>
 #include <stdint.h>
 
+#ifndef _WIN32
+# include <sys/uio.h>
+#endif
+
 /**
  * fifo result
  */
@@ -95,6 +99,39 @@ extern "C"
 #endif
 
 
+/**
+ * pipe msg frame on wire:
+ *
+ *   int32 header | uint32 reqid (if FIFO_FRAME_F_REQID) | msg body
+ *
+ * low 16 bits of header is size of msg body, high bits are frame flags.
+ * a frame without flags is exactly fifo_pipemsg_t. every frame is sent
+ * in one write up to PIPEMSG_SIZE_MAX bytes so it is atomic.
+ */
+#define FIFO_FRAME_SIZE_MASK     0x0000FFFF
+
+// 4 bytes request id follows header. reply carries id of its request.
+#define FIFO_FRAME_F_REQID       0x00010000
+
+// frame is a chunk of a large msg and more chunks follow. the last chunk
+//   has no FIFO_FRAME_F_MORE.
+#define FIFO_FRAME_F_MORE        0x00020000
+
+// no msg: wakes up peer sleeping on a shared memory ring
+#define FIFO_FRAME_F_DOORBELL    0x00040000
+
+// one-way msg which has no reply. it always has FIFO_FRAME_F_REQID and
+//   the id is sequence number of one-way msgs of the client from 1.
+#define FIFO_FRAME_F_ONEWAY      0x00080000
+
+// cumulative ack of one-way msgs from server: FIFO_FRAME_F_REQID with id
+//   of last one received and uint32 body of msgs lost so far.
+#define FIFO_FRAME_F_ACK         0x00100000
+
+// max size of msg body in a frame with request id
+#define PIPEMSG_REQID_BODY_MAX   (PIPEMSG_SIZE_MAX - 8)
+
+
 /**
  * fifo atomic pipe message buffer
  */
@@ -116,6 +153,110 @@ typedef void (*fifo_onpipemsg_cb)(const fifo_pipemsg_t *request, fifo_pipemsg_t
 typedef int (*fifo_serverloop_cb)(void *argument);
 
 
+/**
+ * fifo server mode
+ *
+ *   FIFO_SERVER_MODE_THREADS - one thread per client blocked in select().
+ *   FIFO_SERVER_MODE_REACTOR - a few epoll reactor threads own the accept
+ *                              pipe and all of the client pipes (Linux).
+ *                              replies to a client which does not read
+ *                              them are queued and its requests are not
+ *                              read until they are written out.
+ */
+#define FIFO_SERVER_MODE_DEFAULT    0
+#define FIFO_SERVER_MODE_THREADS    1
+#define FIFO_SERVER_MODE_REACTOR    2
+
+#ifndef FIFO_REACTORS_MAX
+    # define FIFO_REACTORS_MAX     64
+#endif
+
+#ifndef FIFO_WORKERS_MAX
+    # define FIFO_WORKERS_MAX      256
+#endif
+
+#ifndef FIFO_BATCH_MAX
+    # define FIFO_BATCH_MAX        256
+#endif
+
+#ifndef FIFO_PROCESSES_MAX
+    # define FIFO_PROCESSES_MAX    64
+#endif
+
+
+/**
+ * fifo server options for fifo_server_new_ex(). zero means default.
+ */
+typedef struct
+{
+    // FIFO_SERVER_MODE_*
+    int mode;
+
+    // number of reactor threads in FIFO_SERVER_MODE_REACTOR: 1 by default
+    int reactors;
+
+    // 1: sharded reactors. every reactor is pinned to a cpu and owns its
+    //   own accept pipe (lane): lane 0 is pipename, lane k is "pipename-k".
+    //   clients pick a lane by hash of pid.
+    int sharded;
+
+    // number of pre-spawned worker threads which run handlers for ready
+    //   pipes in FIFO_SERVER_MODE_REACTOR:
+    //    0: no workers, handlers run in reactor threads
+    //   -1: one worker per online cpu
+    int workers;
+
+    // max requests passed to batch handler in one call: 64 by default,
+    //   up to FIFO_BATCH_MAX
+    int batchsize;
+
+    // 1: two-stage pipeline in FIFO_SERVER_MODE_REACTOR. reactors only
+    //   read, decode and write; every request in one frame runs in
+    //   workers (one per online cpu if workers is 0) and its reply comes
+    //   back to the reactor of the pipe through a completion queue, so
+    //   a slow handler never stalls i/o. requests without id of a pipe
+    //   run one at a time in order. large msgs, msgbufcb and batches run
+    //   in workers as well, in order with requests without id.
+    int pipeline;
+
+    // 1: work-stealing workers. every worker has its own run queue and
+    //   an idle one steals the older half of tasks of another picked at
+    //   random, so hot pipes never pile up behind one queue or thread.
+    //   tasks queued by a worker stay on its queue for cache locality.
+    int steal;
+
+    // max us reactors and pipe threads busy-poll before they block, 0 for
+    //   none. see busy-poll below.
+    int busypoll;
+
+    // cpu list like "0-3,6" server threads are pinned to, null for none
+    //   (sharded reactors still run on k-th cpu allowed). cpus process may
+    //   not run on (taskset, cgroup cpuset) are left out. reactor k runs
+    //   on k-th cpu of list and worker k on the (reactors + k)-th, wrapping
+    //   around; pipe threads in FIFO_SERVER_MODE_THREADS run on any of
+    //   them. threads created by server are named "fifo-reactor-k",
+    //   "fifo-worker-k" and "fifo-pipe-fd" either way, so per-thread
+    //   profiles are readable. caller thread, which drives reactor 0,
+    //   keeps its name.
+    const char *cpus;
+
+    // 1: reply path of a client runs on the cpu the client connected
+    //   from: its pipe thread is pinned there in FIFO_SERVER_MODE_THREADS
+    //   (if in cpus), or its pipe goes to a reactor on that cpu if any
+    //   (not sharded).
+    int colocate;
+
+    // number of worker processes forked by fifo_server_runforever, up to
+    //   FIFO_PROCESSES_MAX, 0 for none. every worker is a whole server as
+    //   configured above and they read connect msgs from the accept pipe
+    //   under a lock shared by them, so handlers which are not
+    //   thread-safe or leak are isolated per process. caller process
+    //   only supervises: a worker which exits is forked again, and all of
+    //   them are killed when servloopcb returns 0 or caller dies.
+    int processes;
+} fifo_server_opts_t;
+
+
 /**
  * fifo_onpipemsg_cb sample
  */
@@ -136,7 +277,12 @@ static void fifoReplyForRequest (const fifo_pipemsg_t *request, fifo_pipemsg_t *
  */
 const char * fifo_server_get_pipename (fifo_server server);
 int fifo_server_new (const char *pipename, int client_timeout, int connect_timeout, fifo_server *server);
+int fifo_server_new_ex (const char *pipename, int client_timeout, int connect_timeout, const fifo_server_opts_t *opts, fifo_server *server);
 void fifo_server_runforever (fifo_server server, fifo_onpipemsg_cb pipemsgcb, void *msgcbarg, fifo_serverloop_cb servloopcb, void *loopcbarg);
+
+// reactor and worker threads are stopped and joined first. call it
+//   when runforever is over, like from atexit, never while another
+//   thread runs it.
 void fifo_server_free (fifo_server server);
 
 const char * fifo_client_get_pipename (fifo_client client);
@@ -145,6 +291,345 @@ void fifo_client_free (fifo_client client);
 int fifo_client_write (fifo_client client, const fifo_pipemsg_t *msg);
 int fifo_client_read (fifo_client client, fifo_pipemsg_t *msg);
 
+/**
+ * fifo_client_write_batch()
+ *   write nmsgs msgs as requests in as few syscalls as possible. each
+ *   write carries whole frames up to PIPEMSG_SIZE_MAX bytes, so it is
+ *   still atomic.
+ */
+int fifo_client_write_batch (fifo_client client, const fifo_pipemsg_t *msgs[], int nmsgs);
+
+/**
+ * pipelined requests (Linux only)
+ *
+ *   fifo_client_send() sends msg tagged with a new request id (returned
+ *     in reqid) without waiting for reply. msgsz is up to
+ *     PIPEMSG_REQID_BODY_MAX.
+ *   fifo_client_recv() receives next reply and id of the request it
+ *     answers. replies may arrive out of order if server has workers.
+ */
+#ifndef _WIN32
+int fifo_client_send (fifo_client client, const fifo_pipemsg_t *msg, uint32_t *reqid);
+int fifo_client_recv (fifo_client client, fifo_pipemsg_t *msg, uint32_t *reqid);
+#endif
+
+
+/**
+ * asynchronous calls (Linux only)
+ *
+ *   fifo_client_call_async() sends msg as a pipelined request and returns
+ *     at once. replycb is called later from fifo_client_poll(). if pipe
+ *     stays full for wait_timeout of client, request is not sent and
+ *     FIFO_E_TIMEOUT is returned.
+ *   fifo_client_poll() waits up to timeout ms (-1 infinite) for replies on
+ *     all of given clients and completes their calls. calls without reply
+ *     in wait_timeout of client complete with FIFO_E_TIMEOUT. returns
+ *     number of calls completed.
+ *   fifo_client_pending() returns number of calls not yet completed.
+ *
+ *   one thread may drive thousands of calls across many clients this way.
+ *   do not mix with fifo_client_read/recv on the same client.
+ */
+#ifndef _WIN32
+/**
+ * status:
+ *   FIFO_S_OK: reply is valid
+ *   FIFO_E_TIMEOUT: no reply in time (reply is NULL)
+ *   FIFO_E_FAILED: client freed before reply (reply is NULL)
+ */
+typedef void (*fifo_onreply_cb)(fifo_client client, int status, const fifo_pipemsg_t *reply, void *argument);
+
+int fifo_client_call_async (fifo_client client, const fifo_pipemsg_t *msg, fifo_onreply_cb replycb, void *argument);
+int fifo_client_poll (fifo_client *clients, int numclients, int timeout);
+int fifo_client_pending (fifo_client client);
+#endif
+
+
+/**
+ * large messages (Linux only)
+ *
+ *   msgs of any size up to FIFO_MSGBUF_MAX are sent as a sequence of
+ *   atomic chunk frames and assembled by the peer into a growable
+ *   fifo_msgbuf_t.
+ *
+ *   fifo_client_sendmsg() sends msgsz bytes as one request.
+ *   fifo_client_writev() sends one request gathered from n iov, framed
+ *     without copy: a header struct and a body kept elsewhere go out in
+ *     one writev if they fit in one frame.
+ *   fifo_client_recvmsg() receives one whole reply into msg, which is
+ *     grown as needed. free it by fifo_msgbuf_free() when done.
+ *   fifo_server_runforever_ex() serves with a handler: msgbufcb gets
+ *     requests of any size and may reply any size by growing reply with
+ *     fifo_msgbuf_reserve(). requests fit in one frame go to pipemsgcb
+ *     if set.
+ *
+ * zero-copy handler (Linux only)
+ *
+ *   viewcb is called instead of pipemsgcb if set. it gets the request
+ *   as a read-only view into receive buffer of the pipe, valid only
+ *   until it returns. large requests are assembled first and go to
+ *   viewcb too if msgbufcb is not set. it replies at most once by:
+ *     fifo_reply_buffer(): room for a reply body in the outgoing buffer,
+ *       to be filled and then fifo_reply_commit() with the real size.
+ *     fifo_reply_iov(): reply body of any size gathered from iov,
+ *       written out after replies packed so far without copy. meant for
+ *       large parts kept by the application; small replies pack better
+ *       with the above.
+ *   a request with id run by workers is copied out of the receive
+ *   buffer once, since the pipe goes on reading while it runs.
+ *
+ * batch handler (Linux only)
+ *
+ *   pipemsgscb is called instead of pipemsgcb and viewcb if set. it gets
+ *   all of requests fit in one frame decoded from a pipe in one wakeup,
+ *   up to batchsize of server options per call, so that work like a db
+ *   lookup or a lock is shared by them. replies[i] (msgsz 0 for none)
+ *   answers reqs[i] and all of replies go out together. a batch of
+ *   requests all with id goes to workers if server has them.
+ *
+ * one-way msgs (Linux only)
+ *
+ *   fifo_client_notify() sends a msg which has no reply, so the client
+ *     never waits and producers stream at pipe bandwidth (with write
+ *     coalescing best). msgsz is up to PIPEMSG_REQID_BODY_MAX.
+ *   notifycb of handler gets them with no reply work at all (by workers
+ *     if server has them). they are dropped if notifycb is not set.
+ *   server checks sequence numbers to detect and count lost msgs, and
+ *     acks msgs of each wakeup with one cumulative ack, which client
+ *     takes as it goes on sending or reading replies.
+ *   fifo_client_notify_stats() returns msgs sent, acked and lost.
+ */
+#ifndef _WIN32
+
+#ifndef FIFO_MSGBUF_MAX
+    # define FIFO_MSGBUF_MAX      (64 * 1024 * 1024)
+#endif
+
+typedef struct
+{
+    // bytes size of msg
+    size_t msgsz;
+
+    // bytes allocated for msgbuf
+    size_t bufsz;
+    char *msgbuf;
+} fifo_msgbuf_t;
+
+typedef void (*fifo_onmsgbuf_cb)(const fifo_msgbuf_t *request, fifo_msgbuf_t *reply, void *argument);
+
+typedef struct fifo_reply_t fifo_reply_t;
+
+typedef void (*fifo_onmsgview_cb)(const char *msg, int msgsz, fifo_reply_t *reply, void *argument);
+
+typedef void (*fifo_onpipemsgs_cb)(const fifo_pipemsg_t **reqs, fifo_pipemsg_t **replies, int n, void *argument);
+
+typedef void (*fifo_onnotify_cb)(const char *msg, int msgsz, void *argument);
+
+typedef struct
+{
+    // one-way msgs sent
+    uint32_t sent;
+
+    // sequence number of last one acked by server
+    uint32_t acked;
+
+    // lost as seen by server
+    uint32_t lost;
+} fifo_notify_stats_t;
+
+typedef struct
+{
+    // optional: requests fit in one frame
+    fifo_onpipemsg_cb pipemsgcb;
+
+    // optional: requests of any size
+    fifo_onmsgbuf_cb msgbufcb;
+
+    void *argument;
+
+    // optional: zero-copy flavor of pipemsgcb
+    fifo_onmsgview_cb viewcb;
+
+    // optional: batch flavor of pipemsgcb
+    fifo_onpipemsgs_cb pipemsgscb;
+
+    // optional: one-way msgs
+    fifo_onnotify_cb notifycb;
+} fifo_handler_t;
+
+int fifo_msgbuf_reserve (fifo_msgbuf_t *msg, size_t bufsz);
+void fifo_msgbuf_free (fifo_msgbuf_t *msg);
+
+char * fifo_reply_buffer (fifo_reply_t *reply, int bufsz);
+int fifo_reply_commit (fifo_reply_t *reply, int msgsz);
+int fifo_reply_iov (fifo_reply_t *reply, const struct iovec *iov, int iovcnt);
+
+void fifo_server_runforever_ex (fifo_server server, const fifo_handler_t *handler, fifo_serverloop_cb servloopcb, void *loopcbarg);
+
+int fifo_client_sendmsg (fifo_client client, const char *msgbuf, size_t msgsz);
+int fifo_client_writev (fifo_client client, const struct iovec *iov, int n);
+
+int fifo_client_notify (fifo_client client, const char *msg, int msgsz);
+void fifo_client_notify_stats (fifo_client client, fifo_notify_stats_t *stats);
+int fifo_client_recvmsg (fifo_client client, fifo_msgbuf_t *msg);
+#endif
+
+
+/**
+ * shared memory transport (Linux only)
+ *
+ *   client with shmsize maps a pair of rings (requests and replies) in
+ *   shared memory which server attaches on connect. msgs go through the
+ *   rings and pipes only carry doorbells to wake up a sleeping peer. if
+ *   server does not attach, client falls back to pipes. all of client
+ *   and server api work the same on both transports. server never waits
+ *   on a full reply ring: replies are queued like for pipes, and a client
+ *   which reads none of them within client_timeout is closed.
+ *
+ * write coalescing (Linux only)
+ *
+ *   client with coalesce keeps small requests and writes them together
+ *   in one atomic write when coalesce bytes are buffered, when a request
+ *   has waited linger us (checked as requests are written), or before
+ *   client waits for replies in read, recv or poll. a client which stops
+ *   writing without waiting for replies calls fifo_client_flush().
+ *   with adaptive, linger is halved when latency of replies rises and
+ *   grows back slowly up to the given linger.
+ */
+#ifndef _WIN32
+
+#ifndef FIFO_SHM_RING_MIN
+    # define FIFO_SHM_RING_MIN    (64 * 1024)
+#endif
+
+#ifndef FIFO_SHM_RING_MAX
+    # define FIFO_SHM_RING_MAX    (64 * 1024 * 1024)
+#endif
+
+/**
+ * fifo client options for fifo_client_new_ex(). zero means default.
+ */
+typedef struct
+{
+    // bytes of each shared memory ring, rounded up to power of 2 within
+    //   FIFO_SHM_RING_MIN..FIFO_SHM_RING_MAX. 0 for pipes only.
+    int shmsize;
+
+    // bytes of requests coalesced in one write, up to PIPEMSG_SIZE_MAX.
+    //   0 to write every request at once.
+    int coalesce;
+
+    // max us a request waits to be coalesced: 200 by default, -1 for no
+    //   limit
+    int linger;
+
+    // 1: linger adapts to latency of replies
+    int adaptive;
+
+    // max us fifo_client_read() busy-polls the reply pipe before it
+    //   blocks, 0 for none. see busy-poll below.
+    int busypoll;
+} fifo_client_opts_t;
+
+int fifo_client_new_ex (const char *pipename, int wait_timeout, const fifo_client_opts_t *opts, fifo_client *client);
+int fifo_client_flush (fifo_client client);
+#endif
+
+
+/**
+ * busy-poll (Linux only)
+ *
+ *   with busypoll a wait first spins on non-blocking reads of the pipe
+ *   (epoll_wait with no timeout in reactors) and blocks only if nothing
+ *   comes within its budget, which saves the wakeup latency of a
+ *   blocking wait for each hop. budget adapts to average time waited for
+ *   data: twice of it up to busypoll, none if data takes longer, so cpu
+ *   is burnt only where data comes soon. no spinning with one cpu. waits
+ *   on shared memory rings spin by themselves.
+ *   fifo_client_spin_stats() and fifo_server_spin_stats() report cpu us
+ *   burnt spinning, waits served by spinning (hits) and waits which
+ *   spun in vain then blocked (misses).
+ */
+#ifndef _WIN32
+typedef struct
+{
+    // us of cpu burnt spinning
+    uint64_t spinusec;
+
+    uint64_t hits;
+    uint64_t misses;
+
+    // us budget of last wait
+    int budget;
+} fifo_spin_stats_t;
+
+void fifo_client_spin_stats (fifo_client client, fifo_spin_stats_t *stats);
+void fifo_server_spin_stats (fifo_server server, fifo_spin_stats_t *stats);
+#endif
+
+
+/**
+ * request arena (Linux only)
+ *
+ *   fifo_request_arena() returns arena for the request being handled. it
+ *   is valid only inside a server callback. memory taken from it by
+ *   mem_arena_alloc() of memapi.h needs no free: server resets the arena
+ *   after reply is written.
+ */
+#ifndef _WIN32
+struct mem_arena_t;
+
+struct mem_arena_t * fifo_request_arena (void);
+#endif
+
+/**
+ * retained msgs (Linux only)
+ *
+ *   requests passed to pipemsgcb live in refcounted buffers of server.
+ *   fifo_pipemsg_retain() keeps a request valid after callback returns,
+ *   so it may be kept or handed over to another thread without copying.
+ *   each retain is paired with a fifo_pipemsg_release() in any thread.
+ */
+#ifndef _WIN32
+const fifo_pipemsg_t * fifo_pipemsg_retain (const fifo_pipemsg_t *msg);
+void fifo_pipemsg_release (const fifo_pipemsg_t *msg);
+#endif
+
+/**
+ * deferred replies (Linux only)
+ *
+ *   a handler which waits on something else (another local service, a
+ *   disk) calls fifo_reply_defer() inside pipemsgcb, msgbufcb or viewcb
+ *   and returns at once, so its thread goes on with other requests. the
+ *   reply filled by the callback, if any, is dropped. the token is then
+ *   completed exactly once by fifo_reply_send() from any thread; msgsz
+ *   0 completes it with no reply. it is gone after fifo_reply_send()
+ *   returns, but for FIFO_E_BADARG.
+ *   the request is gone after callback returns: retain or copy what is
+ *   needed. replies to requests without id go out in order completed,
+ *   so defer those only if client waits for each reply.
+ *   fifo_reply_defer() returns NULL outside of these callbacks, in batch
+ *   handler and notifycb, and in the io_uring reactor.
+ */
+#ifndef _WIN32
+typedef struct fifo_reply_token_t * fifo_reply_token;
+
+fifo_reply_token fifo_reply_defer (void);
+int fifo_reply_send (fifo_reply_token token, const char *msg, size_t msgsz);
+#endif
+
+/**
+ * object pools (Linux only)
+ *
+ *   per-pipe and per-msg objects of servers and clients come from object
+ *   pools of memapi.h shared by the process. fifo_print_pools() prints
+ *   their counters: hits is share of allocs served from thread caches
+ *   without lock.
+ */
+#ifndef _WIN32
+void fifo_print_pools (void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
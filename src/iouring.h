@@ -0,0 +1,275 @@
+/***********************************************************************
+ * Copyright (c) 2008-2080 pepstack.com, 350137278@qq.com
+ *
+ * ALL RIGHTS RESERVED.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **********************************************************************/
+
+/**
+ * @filename   iouring.h
+ *   minimal io_uring api on raw syscalls (no liburing) for Linux.
+ *
+ * refer:
+ *   https://kernel.dk/io_uring.pdf
+ *   https://man7.org/linux/man-pages/man7/io_uring.7.html
+ *
+ * @author     Liang Zhang <350137278@qq.com>
+ * @version    0.0.1
+ * @create     2020-05-22 10:12:40
+ * @update     2020-05-22 10:12:40
+ */
+#ifndef IOURING_H_INCLUDED
+#define IOURING_H_INCLUDED
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+
+#ifndef NOWARNING_UNUSED
+    # if defined(__GNUC__) || defined(__CYGWIN__)
+        # define NOWARNING_UNUSED(x) __attribute__((unused)) x
+    # else
+        # define NOWARNING_UNUSED(x) x
+    # endif
+#endif
+
+
+#ifndef STATIC_INLINE
+    # if defined(__GNUC__) || defined(__CYGWIN__)
+        # define STATIC_INLINE  NOWARNING_UNUSED(static) __attribute__((always_inline)) inline
+    # else
+        # define STATIC_INLINE  NOWARNING_UNUSED(static)
+    # endif
+#endif
+
+
+typedef struct
+{
+    int ringfd;
+
+    // submission queue
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // sqes prepared but not yet submitted
+    unsigned int sq_pending;
+
+    // completion queue
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    size_t sq_size;
+
+    void *cq_ptr;
+    size_t cq_size;
+
+    size_t sqes_size;
+} iouring_t;
+
+
+/**
+ * iouring_init()
+ *   setup a ring with given entries.
+ *
+ * returns:
+ *    0: success
+ *   -1: io_uring not available (errno set)
+ */
+NOWARNING_UNUSED(static) int iouring_init (iouring_t *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->ringfd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->ringfd == -1) {
+        return (-1);
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(0, ring->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->ringfd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        goto error_exit;
+    }
+
+    ring->cq_ptr = mmap(0, ring->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->ringfd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+        ring->cq_ptr = NULL;
+        goto error_exit;
+    }
+
+    ring->sqes = (struct io_uring_sqe *) mmap(0, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->ringfd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error_exit;
+    }
+
+    ring->sq_head = (unsigned int *) ((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int *) ((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) ((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) ((char *)ring->sq_ptr + p.sq_off.array);
+
+    ring->cq_head = (unsigned int *) ((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int *) ((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) ((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *)ring->cq_ptr + p.cq_off.cqes);
+
+    return 0;
+
+error_exit:
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->cq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    close(ring->ringfd);
+    ring->ringfd = -1;
+    return (-1);
+}
+
+
+NOWARNING_UNUSED(static) void iouring_exit (iouring_t *ring)
+{
+    if (ring->ringfd != -1) {
+        munmap(ring->sqes, ring->sqes_size);
+        munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->ringfd);
+        ring->ringfd = -1;
+    }
+}
+
+
+/**
+ * iouring_get_sqe()
+ *   get a free sqe to prepare. returns NULL if submission queue is full.
+ */
+STATIC_INLINE struct io_uring_sqe * iouring_get_sqe (iouring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = *ring->sq_tail + ring->sq_pending;
+
+    if (tail - head > *ring->sq_mask) {
+        return NULL;
+    }
+
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    ring->sq_pending++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+/**
+ * iouring_prep_rw()
+ *   prepare read or write on a stream (pipe) fd.
+ */
+STATIC_INLINE void iouring_prep_rw (struct io_uring_sqe *sqe, int opcode, int fd, const void *buf, unsigned int len, uint64_t userdata)
+{
+    sqe->opcode = (uint8_t) opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+
+    // current position: pipes have no offset
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = userdata;
+}
+
+
+/**
+ * iouring_submit_and_wait()
+ *   submit all prepared sqes and wait for at least waitnr completions
+ *   in one syscall.
+ *
+ * returns:
+ *   number of sqes submitted, or -1 if error (errno set).
+ */
+STATIC_INLINE int iouring_submit_and_wait (iouring_t *ring, unsigned int waitnr)
+{
+    int ret;
+    unsigned int submit = ring->sq_pending;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+
+    do {
+        ret = (int) syscall(__NR_io_uring_enter, ring->ringfd, submit, waitnr, waitnr? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret;
+}
+
+
+/**
+ * iouring_peek_cqe()
+ *   get next completion or NULL if none. call iouring_cqe_seen() after
+ *   the cqe has been consumed.
+ */
+STATIC_INLINE struct io_uring_cqe * iouring_peek_cqe (iouring_t *ring)
+{
+    unsigned int head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+STATIC_INLINE void iouring_cqe_seen (iouring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOURING_H_INCLUDED */
@@ -195,6 +195,746 @@ STATIC_INLINE void mem_free_s (void **pptr)
     }
 }
 
+/**
+ * arena api
+ *
+ *   bump allocator over chained blocks. memory of arena is not freed one
+ *   by one but all at once by mem_arena_reset() or mem_arena_destroy().
+ *   an arena is not thread safe.
+ */
+#ifndef MEMAPI_ARENA_ALIGN
+    # define MEMAPI_ARENA_ALIGN   16
+#endif
+
+typedef struct mem_arena_block_t
+{
+    struct mem_arena_block_t *next;
+
+    size_t size;
+    size_t used;
+
+    // keep data aligned
+    size_t pad;
+
+    char data[0];
+} mem_arena_block_t;
+
+
+typedef struct mem_arena_t
+{
+    // bytes of a regular block
+    size_t blocksz;
+
+    // newest block first. the last one is kept by reset
+    mem_arena_block_t *blocks;
+} mem_arena_t;
+
+
+NOWARNING_UNUSED(static) mem_arena_block_t * mem_arena_newblock (mem_arena_t *arena, size_t size)
+{
+    mem_arena_block_t *block = (mem_arena_block_t *) mem_alloc_unset(sizeof(*block) + size);
+
+    block->size = size;
+    block->used = 0;
+
+    block->next = arena->blocks;
+    arena->blocks = block;
+
+    return block;
+}
+
+
+/**
+ * mem_arena_create() creates an arena allocating blocks of blocksz bytes.
+ */
+STATIC_INLINE mem_arena_t * mem_arena_create (size_t blocksz)
+{
+    mem_arena_t *arena = (mem_arena_t *) mem_alloc_zero(1, sizeof(*arena));
+
+    arena->blocksz = (blocksz + MEMAPI_ARENA_ALIGN - 1) & ~((size_t) MEMAPI_ARENA_ALIGN - 1);
+    mem_arena_newblock(arena, arena->blocksz);
+
+    return arena;
+}
+
+
+/**
+ * mem_arena_alloc() gets size bytes aligned to MEMAPI_ARENA_ALIGN from
+ *  arena. a size larger than blocksz gets a block of its own.
+ *  THE MEMORY IS NOT INITIALIZED.
+ */
+STATIC_INLINE void * mem_arena_alloc (mem_arena_t *arena, size_t size)
+{
+    void *p;
+    mem_arena_block_t *block = arena->blocks;
+
+    size = (size + MEMAPI_ARENA_ALIGN - 1) & ~((size_t) MEMAPI_ARENA_ALIGN - 1);
+
+    if (block->size - block->used < size) {
+        block = mem_arena_newblock(arena, size > arena->blocksz? size : arena->blocksz);
+    }
+
+    p = block->data + block->used;
+    block->used += size;
+
+    return p;
+}
+
+
+STATIC_INLINE void * mem_arena_alloc_zero (mem_arena_t *arena, size_t size)
+{
+    void *p = mem_arena_alloc(arena, size);
+    memset(p, 0, size);
+    return p;
+}
+
+
+STATIC_INLINE char * mem_arena_strdup (mem_arena_t *arena, const char *s)
+{
+    if (s) {
+        size_t sz = strlen(s) + sizeof(char);
+        char *d = (char *) mem_arena_alloc(arena, sz);
+        memcpy(d, s, sz);
+        return d;
+    }
+    return 0;
+}
+
+
+/**
+ * mem_arena_reset() frees all memory allocated from arena. only the
+ *  first block is kept for reuse.
+ */
+STATIC_INLINE void mem_arena_reset (mem_arena_t *arena)
+{
+    mem_arena_block_t *block;
+
+    while ((block = arena->blocks)->next) {
+        arena->blocks = block->next;
+        mem_free(block);
+    }
+
+    block->used = 0;
+}
+
+
+STATIC_INLINE void mem_arena_destroy (mem_arena_t *arena)
+{
+    if (arena) {
+        mem_arena_reset(arena);
+        mem_free(arena->blocks);
+        mem_free(arena);
+    }
+}
+
+
+#ifndef _WIN32
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * object pool api (not for windows)
+ *
+ *   fixed size objects are carved from slabs. each thread caches a few
+ *   free objects of a pool so that alloc and free take no lock and share
+ *   no cache line with other threads in steady state. all objects of a pool are freed at once by mem_pool_clear()
+ *   or mem_pool_destroy().
+ *
+ *   objects cached by a thread go back to the shared list of their pool
+ *   when the thread exits or another pool takes their cache slot. a pool
+ *   is meant to be used in one source file, since the thread caches are
+ *   static to it.
+ */
+#ifndef MEMAPI_POOL_SLOTS
+    // thread cache slots: more pools alive than this share slots, and
+    //   the cache of one is given back when another takes the slot
+    # define MEMAPI_POOL_SLOTS    32
+#endif
+
+#ifndef MEMAPI_POOL_CACHE
+    // max free objects cached by a thread for a pool
+    # define MEMAPI_POOL_CACHE    64
+#endif
+
+#ifndef MEMAPI_POOL_SLABSZ
+    # define MEMAPI_POOL_SLABSZ   (64 * 1024)
+#endif
+
+// default alignment of slab head and objects
+#define MEMAPI_POOL_ALIGN         16
+
+// objects of mem_buf_t pools are aligned to this
+#define MEMAPI_CACHELINE          64
+
+
+typedef struct
+{
+    // objects allocated and how many were taken from thread cache
+    uint64_t allocs;
+    uint64_t hits;
+
+    // thread cache refilled from or flushed to the shared list
+    uint64_t refills;
+    uint64_t flushes;
+
+    uint64_t slabs;
+} mem_pool_stats_t;
+
+
+typedef struct mem_pool_t
+{
+    pthread_mutex_t lock;
+
+    size_t objsz;
+
+    // power of 2, at least MEMAPI_POOL_ALIGN
+    size_t align;
+
+    // unique id, 0 until first use. changed when pool is cleared
+    uint32_t id;
+
+    // shared free objects
+    void *freelist;
+
+    // slabs chained by their first word
+    void *slabs;
+
+    mem_pool_stats_t stats;
+
+    // allocated by mem_pool_create()
+    int created;
+
+    // in list of pools thread caches give objects back to
+    int listed;
+    struct mem_pool_t *next;
+} mem_pool_t;
+
+
+typedef struct
+{
+    uint32_t id;
+    int count;
+    void *head;
+
+    // pool of id, only valid while it is listed with id. changed under
+    //   registry lock
+    mem_pool_t *pool;
+
+    // allocs and hits of pool by this thread not yet added to pool stats.
+    //   only owner thread writes them, so no cache line is shared
+    uint64_t allocs;
+    uint64_t hits;
+} mem_pool_cache_t;
+
+
+typedef struct mem_pool_thread_t
+{
+    mem_pool_cache_t caches[MEMAPI_POOL_SLOTS];
+
+    // in list of threads whose caches mem_pool_get_stats() counts
+    int listed;
+    struct mem_pool_thread_t *next;
+} mem_pool_thread_t;
+
+
+typedef struct
+{
+    // guards lists of pools and threads. taken before lock of a pool
+    pthread_mutex_t lock;
+    mem_pool_t *pools;
+    mem_pool_thread_t *threads;
+
+    // key whose destructor gives back caches of exiting thread
+    pthread_once_t once;
+    pthread_key_t key;
+} mem_pool_registry_t;
+
+
+#define MEM_POOL_INITIALIZER_ALIGNED(objsz, align)  \
+    {PTHREAD_MUTEX_INITIALIZER, (objsz), (align), 0, NULL, NULL, {0, 0, 0, 0, 0}, 0, 0, NULL}
+
+#define MEM_POOL_INITIALIZER(objsz)  MEM_POOL_INITIALIZER_ALIGNED(objsz, MEMAPI_POOL_ALIGN)
+
+
+/**
+ * mem_alloc_aligned() allocates size bytes aligned to align, which is a
+ *  power of 2 and multiple of sizeof(void *). free it by mem_free().
+ *  THE MEMORY IS NOT INITIALIZED.
+ */
+STATIC_INLINE void * mem_alloc_aligned (size_t align, size_t size)
+{
+    void *p = NULL;
+    int err =
+        #ifdef MEMAPI_USE_LIBJEMALLOC
+            je_posix_memalign(&p, align, size);
+        #else
+            posix_memalign(&p, align, size);
+        #endif
+
+    memapi_oom_check(err == 0? p : NULL);
+    return p;
+}
+
+
+NOWARNING_UNUSED(static) uint32_t mem_pool_nextid (void)
+{
+    static uint32_t lastid = 0;
+
+    uint32_t id = __atomic_add_fetch(&lastid, 1, __ATOMIC_RELAXED);
+    if (! id) {
+        id = __atomic_add_fetch(&lastid, 1, __ATOMIC_RELAXED);
+    }
+    return id;
+}
+
+
+NOWARNING_UNUSED(static) mem_pool_registry_t * mem_pool_registry (void)
+{
+    static mem_pool_registry_t registry = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, PTHREAD_ONCE_INIT, 0};
+
+    return &registry;
+}
+
+
+/**
+ * mem_pool_giveback() moves all objects and counters of a thread cache
+ *  to its pool and hands the cache over to pool of id, NULL for none.
+ *  objects of a pool destroyed or cleared since they were cached are
+ *  dropped.
+ */
+NOWARNING_UNUSED(static) void mem_pool_giveback (mem_pool_cache_t *cache, mem_pool_t *newpool, uint32_t newid)
+{
+    mem_pool_registry_t *registry = mem_pool_registry();
+    mem_pool_t *pool;
+    void *tail;
+
+    pthread_mutex_lock(&registry->lock);
+
+    for (pool = registry->pools; pool && pool != cache->pool; pool = pool->next) {
+        ;
+    }
+
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+
+        pool->stats.allocs += cache->allocs;
+        pool->stats.hits += cache->hits;
+
+        if (cache->head && pool->id == cache->id) {
+            for (tail = cache->head; *(void **) tail; tail = *(void **) tail) {
+                ;
+            }
+
+            *(void **) tail = pool->freelist;
+            pool->freelist = cache->head;
+            pool->stats.flushes++;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    cache->id = newid;
+    cache->count = 0;
+    cache->head = NULL;
+    cache->pool = newpool;
+    cache->allocs = 0;
+    cache->hits = 0;
+
+    pthread_mutex_unlock(&registry->lock);
+}
+
+
+NOWARNING_UNUSED(static) void mem_pool_thread_exit (void *arg)
+{
+    int slot;
+    mem_pool_thread_t **link, *thread = (mem_pool_thread_t *) arg;
+    mem_pool_registry_t *registry = mem_pool_registry();
+
+    for (slot = 0; slot < MEMAPI_POOL_SLOTS; slot++) {
+        mem_pool_giveback(&thread->caches[slot], NULL, 0);
+    }
+
+    pthread_mutex_lock(&registry->lock);
+
+    for (link = &registry->threads; *link; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
+        }
+    }
+
+    // pools used by later key destructors list thread again
+    thread->listed = 0;
+
+    pthread_mutex_unlock(&registry->lock);
+}
+
+
+NOWARNING_UNUSED(static) void mem_pool_key_create (void)
+{
+    pthread_key_create(&mem_pool_registry()->key, mem_pool_thread_exit);
+}
+
+
+/**
+ * mem_pool_cache() returns cache of calling thread for pool. objects in
+ *  a cache left by another pool sharing the slot are given back to it.
+ */
+NOWARNING_UNUSED(static) mem_pool_cache_t * mem_pool_cache (mem_pool_t *pool)
+{
+    static __thread mem_pool_thread_t thread;
+
+    mem_pool_cache_t *cache;
+    uint32_t id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+
+    if (! id) {
+        mem_pool_registry_t *registry = mem_pool_registry();
+
+        pthread_mutex_lock(&registry->lock);
+        pthread_mutex_lock(&pool->lock);
+
+        if (! pool->id) {
+            __atomic_store_n(&pool->id, mem_pool_nextid(), __ATOMIC_RELEASE);
+        }
+        if (! pool->listed) {
+            pool->next = registry->pools;
+            registry->pools = pool;
+            pool->listed = 1;
+        }
+        id = pool->id;
+
+        pthread_mutex_unlock(&pool->lock);
+        pthread_mutex_unlock(&registry->lock);
+    }
+
+    cache = &thread.caches[id % MEMAPI_POOL_SLOTS];
+    if (cache->id != id) {
+        if (! thread.listed) {
+            mem_pool_registry_t *registry = mem_pool_registry();
+
+            pthread_once(&registry->once, mem_pool_key_create);
+            pthread_setspecific(registry->key, &thread);
+
+            pthread_mutex_lock(&registry->lock);
+            thread.next = registry->threads;
+            registry->threads = &thread;
+            thread.listed = 1;
+            pthread_mutex_unlock(&registry->lock);
+        }
+
+        mem_pool_giveback(cache, pool, id);
+    }
+
+    return cache;
+}
+
+
+/**
+ * mem_pool_create_aligned() creates a pool of objects of objsz bytes
+ *  aligned to align (power of 2).
+ */
+STATIC_INLINE mem_pool_t * mem_pool_create_aligned (size_t objsz, size_t align)
+{
+    mem_pool_t *pool = (mem_pool_t *) mem_alloc_zero(1, sizeof(*pool));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->objsz = objsz;
+    pool->align = (align > MEMAPI_POOL_ALIGN? align : MEMAPI_POOL_ALIGN);
+    pool->created = 1;
+
+    return pool;
+}
+
+
+STATIC_INLINE mem_pool_t * mem_pool_create (size_t objsz)
+{
+    return mem_pool_create_aligned(objsz, MEMAPI_POOL_ALIGN);
+}
+
+
+/**
+ * mem_pool_clear() frees all objects of pool in bulk. no object of pool
+ *  can be used after it.
+ */
+STATIC_INLINE void mem_pool_clear (mem_pool_t *pool)
+{
+    void *slab;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while ((slab = pool->slabs) != NULL) {
+        pool->slabs = *(void **) slab;
+        mem_free(slab);
+    }
+
+    pool->freelist = NULL;
+
+    // thread caches of old id are dropped
+    __atomic_store_n(&pool->id, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+STATIC_INLINE void mem_pool_destroy (mem_pool_t *pool)
+{
+    mem_pool_registry_t *registry = mem_pool_registry();
+    mem_pool_thread_t *thread;
+    mem_pool_t **link;
+    int slot;
+
+    // thread caches cannot give back to pool once unlisted
+    pthread_mutex_lock(&registry->lock);
+
+    for (link = &registry->pools; *link; link = &(*link)->next) {
+        if (*link == pool) {
+            *link = pool->next;
+            pool->listed = 0;
+            break;
+        }
+    }
+
+    // nor be counted for a new pool at same address
+    for (thread = registry->threads; thread; thread = thread->next) {
+        for (slot = 0; slot < MEMAPI_POOL_SLOTS; slot++) {
+            if (thread->caches[slot].pool == pool) {
+                thread->caches[slot].pool = NULL;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&registry->lock);
+
+    mem_pool_clear(pool);
+
+    if (pool->created) {
+        pthread_mutex_destroy(&pool->lock);
+        mem_free(pool);
+    }
+}
+
+
+/**
+ * mem_pool_refill() moves half of max cached objects from shared list
+ *  to thread cache. a new slab is added if shared list is empty.
+ */
+NOWARNING_UNUSED(static) void mem_pool_refill (mem_pool_t *pool, mem_pool_cache_t *cache)
+{
+    void *obj;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (! pool->freelist) {
+        size_t objsz = (pool->objsz + pool->align - 1) & ~(pool->align - 1);
+        size_t slabsz = pool->align + objsz * 8;
+        char *slab, *p;
+
+        if (slabsz < MEMAPI_POOL_SLABSZ) {
+            slabsz = MEMAPI_POOL_SLABSZ;
+        }
+
+        slab = (char *) mem_alloc_aligned(pool->align, slabsz);
+        *(void **) slab = pool->slabs;
+        pool->slabs = slab;
+        pool->stats.slabs++;
+
+        for (p = slab + pool->align; p + objsz <= slab + slabsz; p += objsz) {
+            *(void **) p = pool->freelist;
+            pool->freelist = p;
+        }
+    }
+
+    while (cache->count < MEMAPI_POOL_CACHE / 2 && (obj = pool->freelist) != NULL) {
+        pool->freelist = *(void **) obj;
+
+        *(void **) obj = cache->head;
+        cache->head = obj;
+        cache->count++;
+    }
+
+    pool->stats.refills++;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * mem_pool_flush() moves half of objects in thread cache to shared list.
+ */
+NOWARNING_UNUSED(static) void mem_pool_flush (mem_pool_t *pool, mem_pool_cache_t *cache)
+{
+    int n = cache->count / 2;
+    void *head = cache->head, *tail = head;
+
+    while (--n > 0) {
+        tail = *(void **) tail;
+    }
+
+    cache->head = *(void **) tail;
+    cache->count -= cache->count / 2;
+
+    pthread_mutex_lock(&pool->lock);
+
+    *(void **) tail = pool->freelist;
+    pool->freelist = head;
+    pool->stats.flushes++;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * mem_pool_alloc() gets an object from pool.
+ *  THE MEMORY IS NOT INITIALIZED.
+ */
+STATIC_INLINE void * mem_pool_alloc (mem_pool_t *pool)
+{
+    void *obj;
+    mem_pool_cache_t *cache = mem_pool_cache(pool);
+
+    // read by mem_pool_get_stats() in other threads: no tearing, no rmw
+    __atomic_store_n(&cache->allocs, cache->allocs + 1, __ATOMIC_RELAXED);
+
+    if (cache->head) {
+        __atomic_store_n(&cache->hits, cache->hits + 1, __ATOMIC_RELAXED);
+    } else {
+        mem_pool_refill(pool, cache);
+    }
+
+    obj = cache->head;
+    cache->head = *(void **) obj;
+    cache->count--;
+
+    return obj;
+}
+
+
+/**
+ * mem_pool_free() gives back an object to pool it was allocated from.
+ */
+STATIC_INLINE void mem_pool_free (mem_pool_t *pool, void *obj)
+{
+    mem_pool_cache_t *cache = mem_pool_cache(pool);
+
+    if (cache->count >= MEMAPI_POOL_CACHE) {
+        mem_pool_flush(pool, cache);
+    }
+
+    *(void **) obj = cache->head;
+    cache->head = obj;
+    cache->count++;
+}
+
+
+/**
+ * mem_pool_get_stats() copies counters of pool, with allocs and hits
+ *  still kept in thread caches.
+ */
+STATIC_INLINE void mem_pool_get_stats (mem_pool_t *pool, mem_pool_stats_t *stats)
+{
+    int slot;
+    mem_pool_thread_t *thread;
+    mem_pool_registry_t *registry = mem_pool_registry();
+
+    pthread_mutex_lock(&registry->lock);
+    pthread_mutex_lock(&pool->lock);
+
+    *stats = pool->stats;
+
+    for (thread = registry->threads; thread; thread = thread->next) {
+        for (slot = 0; slot < MEMAPI_POOL_SLOTS; slot++) {
+            mem_pool_cache_t *cache = &thread->caches[slot];
+
+            if (cache->pool == pool) {
+                stats->allocs += __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED);
+                stats->hits += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&registry->lock);
+}
+
+/**
+ * refcounted buffer api (not for windows)
+ *
+ *   buffers of one size come from a pool made by mem_buf_pool_create() or
+ *   MEM_BUF_POOL_INITIALIZER(). data of a buffer starts at a cache line.
+ *   a buffer can be retained by more holders in any threads and goes back
+ *   to its pool when the last one releases it, so it can be handed over
+ *   between threads without copying data.
+ */
+typedef struct
+{
+    int refc;
+
+    // bytes of data
+    uint32_t size;
+
+    mem_pool_t *pool;
+
+    char data[0] __attribute__((aligned(MEMAPI_CACHELINE)));
+} mem_buf_t;
+
+
+// buffer of data returned by mem_buf_alloc()
+#define mem_buf_of(ptr)   ((mem_buf_t *) ((char *) (ptr) - offsetof(mem_buf_t, data)))
+
+#define MEM_BUF_POOL_INITIALIZER(size)  MEM_POOL_INITIALIZER_ALIGNED(sizeof(mem_buf_t) + (size), MEMAPI_CACHELINE)
+
+
+STATIC_INLINE mem_pool_t * mem_buf_pool_create (size_t size)
+{
+    return mem_pool_create_aligned(sizeof(mem_buf_t) + size, MEMAPI_CACHELINE);
+}
+
+
+/**
+ * mem_buf_alloc() gets a buffer with one reference from pool.
+ *  THE DATA IS NOT INITIALIZED.
+ */
+STATIC_INLINE mem_buf_t * mem_buf_alloc (mem_pool_t *pool)
+{
+    mem_buf_t *buf = (mem_buf_t *) mem_pool_alloc(pool);
+
+    buf->refc = 1;
+    buf->size = (uint32_t) (pool->objsz - sizeof(mem_buf_t));
+    buf->pool = pool;
+
+    return buf;
+}
+
+
+STATIC_INLINE mem_buf_t * mem_buf_retain (mem_buf_t *buf)
+{
+    __atomic_add_fetch(&buf->refc, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+
+STATIC_INLINE void mem_buf_release (mem_buf_t *buf)
+{
+    if (__atomic_sub_fetch(&buf->refc, 1, __ATOMIC_ACQ_REL) == 0) {
+        mem_pool_free(buf->pool, buf);
+    }
+}
+
+
+/**
+ * mem_buf_shared() tells whether buffer has other holders. a buffer not
+ *  shared can be written by its only holder.
+ */
+STATIC_INLINE int mem_buf_shared (mem_buf_t *buf)
+{
+    return (__atomic_load_n(&buf->refc, __ATOMIC_ACQUIRE) > 1);
+}
+
+#endif /* _WIN32 */
+
+
 #if defined (_MSC_VER)
     # pragma warning(pop)
 #endif